@@ -17,11 +17,123 @@ va_is_mapped(void *va)
 	return (uvpd[PDX(va)] & PTE_P) && (uvpt[PGNUM(va)] & PTE_P);
 }
 
+// The blocks written since they were last read or flushed.  Cached
+// blocks are mapped read-only while clean, and bc_pgfault enters a
+// block here on the first write to it, so finding the dirty blocks
+// needs no look at the page tables.
+static uint32_t bc_dirty[DISKSIZE / BLKSIZE / 32];
+static uint32_t bc_ndirty;
+
+// The dirty blocks that became dirty since the last write-back tick
+// (see bc_writeback), and so are too young to write back on the next.
+static uint32_t bc_young[DISKSIZE / BLKSIZE / 32];
+
+static bool
+bc_is_dirty(uint32_t blockno)
+{
+	return (bc_dirty[blockno / 32] & (1 << (blockno % 32))) != 0;
+}
+
+// Will bc_writeback(all) write block 'blockno'?
+static bool
+bc_is_due(uint32_t blockno, bool all)
+{
+	return bc_is_dirty(blockno) && !journal_holds(diskaddr(blockno))
+		&& (all || !(bc_young[blockno / 32] & (1 << (blockno % 32))));
+}
+
+static void
+bc_set_dirty(uint32_t blockno, bool dirty)
+{
+	if (dirty == bc_is_dirty(blockno))
+		return;
+	bc_dirty[blockno / 32] ^= 1 << (blockno % 32);
+	if (dirty) {
+		bc_young[blockno / 32] |= 1 << (blockno % 32);
+		bc_ndirty++;
+	} else {
+		bc_young[blockno / 32] &= ~(1 << (blockno % 32));
+		bc_ndirty--;
+	}
+}
+
 // Is this virtual address dirty?
 bool
 va_is_dirty(void *va)
 {
-	return (uvpt[PGNUM(va)] & PTE_D) != 0;
+	return bc_is_dirty(((uint32_t)va - DISKMAP) / BLKSIZE);
+}
+
+// Write the n cached blocks from 'blockno' on, which are adjacent in
+// memory as on disk, with one ide_write, and mark them clean.
+static void
+bc_write_run(uint32_t blockno, uint32_t n)
+{
+	uint32_t i;
+	int r;
+
+	if ((r = ide_write(blockno * BLKSECTS, diskaddr(blockno), n * BLKSECTS)) < 0)
+		panic("bc_write_run: ide_write: %e", r);
+	for (i = 0; i < n; i++) {
+		// Write-protect it again, which also clears PTE_D.
+		if ((r = sys_page_map(0, diskaddr(blockno + i), 0, diskaddr(blockno + i),
+				      PTE_P|PTE_U)) < 0)
+			panic("bc_write_run: sys_page_map: %e", r);
+		bc_set_dirty(blockno + i, 0);
+	}
+}
+
+// The superblock and bitmap stay cached: every allocation uses them.
+static bool
+bc_pinned(uint32_t blockno)
+{
+	return !super || blockno < 2 + (super->s_nblocks + BLKBITSIZE - 1) / BLKBITSIZE;
+}
+
+// The blocks in the cache, 0 for a free slot, and the CLOCK hand.
+static uint32_t bc_clock[BCSIZE];
+static uint32_t bc_hand;
+
+// Make room for block 'blockno', which is about to be mapped, and
+// enter it in the cache.  When the cache is full, evict by CLOCK: the
+// hand passes over blocks the processor has marked accessed since it
+// last came by, clearing the mark, and evicts the first one that is
+// not.  The only way to clear PTE_A is to remap the page, which clears
+// PTE_D as well, so a dirty block gets written back then instead.
+// Writing back may sleep, letting other coroutines move the hand and
+// use the block, so the victim is checked again after.
+static void
+bc_insert(uint32_t blockno)
+{
+	uint32_t b, h;
+	void *addr;
+	int r;
+
+	if (bc_pinned(blockno))
+		return;
+	for (;; bc_hand = (bc_hand + 1) % BCSIZE) {
+		h = bc_hand;
+		if ((b = bc_clock[h]) == 0 || !va_is_mapped(addr = diskaddr(b)))
+			break;
+		if (journal_holds(addr))
+			continue;	// must stay until the journal commits
+		if (!(uvpt[PGNUM(addr)] & PTE_A)) {
+			flush_block(addr);
+			if (bc_clock[h] != b || va_is_dirty(addr) || journal_holds(addr)
+			    || (uvpt[PGNUM(addr)] & PTE_A))
+				continue;	// taken or used while we slept
+			if ((r = sys_page_unmap(0, addr)) < 0)
+				panic("bc_insert: sys_page_unmap: %e", r);
+			bc_stats.bs_evictions++;
+			break;
+		}
+		if (va_is_dirty(addr))
+			flush_block(addr);
+		else if ((r = sys_page_map(0, addr, 0, addr, uvpt[PGNUM(addr)] & PTE_SYSCALL)) < 0)
+			panic("bc_insert: sys_page_map: %e", r);
+	}
+	bc_clock[h] = blockno;
+	bc_hand = (h + 1) % BCSIZE;
 }
 
 // Fault any disk block that is read in to memory by
@@ -49,15 +161,31 @@ bc_pgfault(struct UTrapframe *utf)
 	//
 	// LAB 5: you code here:
 	addr=ROUNDDOWN(addr,PGSIZE); //将addr向下取证,得到该页开始的地址
+	if (va_is_mapped(addr))      //已缓存的干净块被写:记为脏块,改为可写
+	{
+		if (!(utf->utf_err&FEC_WR))
+			panic("page fault in FS: eip %08x, va %08x, err %04x",
+			      utf->utf_eip, utf->utf_fault_va, utf->utf_err);
+		if ((r=sys_page_map(0,addr,0,addr,PTE_P|PTE_U|PTE_W))<0)
+			panic("in bc_pgfault, sys_page_map: %e", r);
+		bc_set_dirty(blockno,1);
+		return;
+	}
+	bc_insert(blockno);          //缓存已满时先换出一个块
+	bc_stats.bs_misses++;
        if  (sys_page_alloc(0,addr,PTE_W|PTE_U|PTE_P))//在该environment中为分配一个页,映射在addr处
 		panic("here!");
 	if ((r=ide_read(blockno*BLKSECTS,addr,BLKSECTS)))
 	 //使用ide_read从磁盘中读入blockno对应的磁盘块,读至虚拟地址addr处,注意ide_read是以扇区为单位
 		panic("ide_read failed!");
 	// Clear the dirty bit for the disk block page since we just read the
-	// block from disk
-	if ((r = sys_page_map(0, addr, 0, addr, uvpt[PGNUM(addr)] & PTE_SYSCALL)) < 0)
+	// block from disk.  Leave it writable only if this fault was a write,
+	// which makes it dirty.
+	if ((r = sys_page_map(0, addr, 0, addr,
+			      PTE_P|PTE_U|(utf->utf_err & FEC_WR ? PTE_W : 0))) < 0)
 		panic("in bc_pgfault, sys_page_map: %e", r);
+	if (utf->utf_err & FEC_WR)
+		bc_set_dirty(blockno, 1);
 
 	// Check that the block we read was allocated. (exercise for
 	// the reader: why do we do this *after* reading the block
@@ -66,6 +194,84 @@ bc_pgfault(struct UTrapframe *utf)
 		panic("reading free block %08x\n", blockno);
 }
 
+// The blocks each coroutine is reading in with bc_load_run (0 blocks
+// if none), and the coroutines waiting for one of those reads.
+static uint32_t bc_loading[NCORO];
+static uint32_t bc_nloading[NCORO];
+static struct CoroQueue bc_waiters;
+
+// Bring block 'blockno' into the cache if it is not there yet.  A
+// coroutine that calls this before touching a block sleeps while the
+// disk reads it; had it just touched the block, bc_pgfault would have
+// had to poll the disk instead.  Outside a coroutine this does nothing
+// and leaves the read to bc_pgfault.
+// Returns 0 on success, < 0 on error.
+int
+bc_load(uint32_t blockno)
+{
+	return bc_load_run(blockno, 1);
+}
+
+// Like bc_load, but also bring in the n-1 blocks after 'blockno' (n is
+// at most RA_MAX), all in one disk read.  The blocks are read into
+// pages of the coroutine's own and only mapped at their disk addresses
+// once complete, so nobody sees them half read; any of them that got
+// cached meanwhile keep the copy they have.  Nothing is read if block
+// 'blockno' is cached already.
+// Returns 0 on success, < 0 on error.
+int
+bc_load_run(uint32_t blockno, uint32_t n)
+{
+	void *stage;
+	uint32_t i;
+	int id, r;
+
+	if (!coro_can_sleep())
+		return 0;
+	assert(n >= 1 && n <= RA_MAX);
+retry:
+	if (va_is_mapped(diskaddr(blockno))) {
+		bc_stats.bs_hits++;
+		return 0;
+	}
+	for (i = 0; i < NCORO; i++)
+		if (blockno - bc_loading[i] < bc_nloading[i]) {
+			coro_sleep(&bc_waiters);
+			goto retry;
+		}
+
+	id = coro_id();
+	stage = (void *) BCSTAGEVA(id);
+	for (i = 0; i < n; i++)
+		if ((r = sys_page_alloc(0, stage + i * BLKSIZE, PTE_P|PTE_U|PTE_W)) < 0)
+			goto out;
+	bc_loading[id] = blockno;
+	bc_nloading[id] = n;
+	r = ide_read(blockno * BLKSECTS, stage, n * BLKSECTS);
+	bc_nloading[id] = 0;
+	coro_wakeup(&bc_waiters);
+
+	for (i = 0; r == 0 && i < n; i++) {
+		if (va_is_mapped(diskaddr(blockno + i)))
+			continue;
+		bc_insert(blockno + i);
+		if (i == 0)
+			bc_stats.bs_misses++;
+		else
+			bc_stats.bs_readahead++;
+		r = sys_page_map(0, stage + i * BLKSIZE, 0, diskaddr(blockno + i),
+				 PTE_P|PTE_U);
+	}
+out:
+	for (i = 0; i < n; i++)
+		sys_page_unmap(0, stage + i * BLKSIZE);
+	if (r < 0)
+		return r;
+	if (bitmap && block_is_free(blockno))
+		panic("reading free block %08x\n", blockno);
+	return 0;
+}
+
 // Flush the contents of the block containing VA out to disk if
 // necessary, then clear the PTE_D bit using sys_page_map.
 // If the block is not in the block cache or is not dirty, does
@@ -83,15 +289,45 @@ flush_block(void *addr)
 
 	// LAB 5: Your code here.
 	addr=ROUNDDOWN(addr,PGSIZE);
-	if (va_is_mapped(addr)&&va_is_dirty(addr))
-	//如果addr在该environment的地址空间中,且dirty位为0,则需要将修改后的结果写会磁盘,否则无需操作
-	{
-		if (ide_write(blockno*BLKSECTS,addr,BLKSECTS)) //将磁盘块写回
-			panic("wrong!")	;
-		if (sys_page_map(0,addr,0,addr,PTE_SYSCALL))//删除对应页的dirty位
-			panic("wrong here!");	
+	if (journal_holds(addr))  //日志中的元数据块要等日志提交后才能写回原位
+		return;
+	if (va_is_dirty(addr)&&va_is_mapped(addr))
+	//如果该块在脏块集合中(先查集合,不必读页表),则需要将修改后的结果写会磁盘,否则无需操作
+		bc_write_run(blockno,1); //写回并重新设为只读,同时删除dirty位
+}
+
+// Write out dirty blocks, in order of block number, with one ide_write
+// for each run of adjacent ones (up to IOMAXBLKS blocks).  If 'all' is
+// set, write every dirty block.  Otherwise this is a write-back tick:
+// write only the blocks that have stayed dirty since before the last
+// tick, then start the ones left over aging.  That leaves a block
+// written one to two ticks after it first got dirty, however often it
+// is written meanwhile.  Blocks the journal holds are left for it.
+void
+bc_writeback(bool all)
+{
+	uint32_t blockno, n;
+
+	for (blockno = 0; bc_ndirty > 0 && blockno < super->s_nblocks; blockno += n) {
+		n = 1;
+		if (bc_dirty[blockno / 32] == 0)
+			n = 32 - blockno % 32;	// 32 clean blocks at a time
+		else if (bc_is_due(blockno, all)) {
+			while (n < IOMAXBLKS && blockno + n < super->s_nblocks
+			       && bc_is_due(blockno + n, all))
+				n++;
+			bc_write_run(blockno, n);
+		}
 	}
-	
+	if (!all)
+		memset(bc_young, 0, (super->s_nblocks + 31) / 32 * 4);
+}
+
+// How many blocks are dirty.
+uint32_t
+bc_dirty_count(void)
+{
+	return bc_ndirty;
 }
 
 // Test that the block cache works, by smashing the superblock and
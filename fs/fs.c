@@ -1,3 +1,4 @@
+#include <inc/x86.h>
 #include <inc/string.h>
 #include <inc/partition.h>
 
@@ -36,6 +37,40 @@ block_is_free(uint32_t blockno)
 	return 0;
 }
 
+// Free blocks covered by each bitmap block, kept in memory so that
+// alloc_block can skip full stretches of the disk, and the block after
+// the last one allocated, where the next search starts (next fit).
+#define NBITBLOCKS	(DISKSIZE / BLKSIZE / BLKBITSIZE)
+#define BLKWORDS	(BLKBITSIZE / 32)
+static uint32_t bitmap_nfree[NBITBLOCKS];
+static uint32_t alloc_next;
+
+// Blocks reserved for growing files (see file_alloc_block): free in the
+// bitmap, but passed over by every other allocation.  Reservations live
+// only in memory, so a crash loses nothing but them.  Dropping all of
+// them at once bumps resv_gen, which invalidates every Prealloc.
+static uint32_t resvmap[NBITBLOCKS * BLKWORDS];
+static uint32_t resv_gen = 1;
+static uint32_t nresv;
+
+static bool
+block_is_reserved(uint32_t blockno)
+{
+	return resvmap[blockno / 32] & (1 << (blockno % 32));
+}
+
+static void
+block_reserve(uint32_t blockno, bool resv)
+{
+	if (resv) {
+		resvmap[blockno / 32] |= 1 << (blockno % 32);
+		nresv++;
+	} else {
+		resvmap[blockno / 32] &= ~(1 << (blockno % 32));
+		nresv--;
+	}
+}
+
 // Mark a block free in the bitmap
 void
 free_block(uint32_t blockno)
@@ -43,17 +78,74 @@ free_block(uint32_t blockno)
 	// Blockno zero is the null pointer of block numbers.
 	if (blockno == 0)
 		panic("attempt to free zero block");
+	if (!block_is_free(blockno))
+		bitmap_nfree[blockno / BLKBITSIZE]++;
+	journal_log(&bitmap[blockno/32]);
 	bitmap[blockno/32] |= 1<<(blockno%32);
 }
 
-// Search the bitmap for a free block and allocate it.  When you
-// allocate a block, immediately flush the changed bitmap block
-// to disk.
+// Mark free block 'blockno' in use.  The bitmap block that changes
+// goes out with the next journal commit.
+static void
+block_take(uint32_t blockno)
+{
+	journal_log(&bitmap[blockno/32]); //被修改的位图块随日志一起写回
+	bitmap[blockno/32]&=~(1<<(blockno%32));//将blockno对应的bit清0
+	bitmap_nfree[blockno/BLKBITSIZE]--;
+}
+
+// Find a free, unreserved block, starting where the last search left
+// off.  If 'run' is set, only take one that starts 32 free blocks in a
+// row.  Skips bitmap blocks with too little free, and tests 32 blocks
+// at a time.  Returns the block number, -E_NO_DISK if there is none.
+static int
+block_find(bool run)
+{
+	uint32_t nbitblocks=ROUNDUP(super->s_nblocks,BLKBITSIZE)/BLKBITSIZE;
+	uint32_t nwords=super->s_nblocks/32+(run?0:(super->s_nblocks%32!=0));
+	uint32_t start,b,w,wend,bits,blockno;
+	int i;
+
+	start=alloc_next/BLKBITSIZE;
+	//从上次分配处开始,绕回后再扫一遍起始位图块的前半部分
+	for (i=0;i<=nbitblocks;i++)
+	{
+		b=(start+i)%nbitblocks;
+		if (bitmap_nfree[b]<(run?32:1))  //该位图块覆盖的空闲磁盘块不够
+			continue;
+		w=(i==0)?alloc_next/32:b*BLKWORDS;
+		wend=MIN((b+1)*BLKWORDS,nwords);
+		for (;w<wend;w++)
+		{
+			bits=bitmap[w]&~resvmap[w];  //一次检查32个磁盘块
+			if (run?bits!=~0U:bits==0)
+				continue;
+			blockno=w*32+bsf(bits);
+			if (blockno>=super->s_nblocks)
+				break;
+			alloc_next=blockno+1<super->s_nblocks?blockno+1:0;
+			return blockno;
+		}
+	}
+	return -E_NO_DISK;
+}
+
+// Drop every reservation, to make their blocks available to all.
+static void
+block_unreserve_all(void)
+{
+	memset(resvmap, 0, sizeof(resvmap));
+	nresv = 0;
+	resv_gen++;
+}
+
+// Search the bitmap for a free block and allocate it.  The changed
+// bitmap block is held by the journal until the next commit.
 //
 // Return block number allocated on success,
 // -E_NO_DISK if we are out of blocks.
 //
-// Hint: use free_block as an example for manipulating the bitmap.
+// Reserved blocks are only taken when nothing else is left.
 int
 alloc_block(void)
 {
@@ -62,17 +154,93 @@ alloc_block(void)
 	// super->s_nblocks blocks in the disk altogether.
 
 	// LAB 5: Your code here.
-	int blockno;
-	for (blockno=0;blockno<super->s_nblocks;blockno++)//遍历所有磁盘块
+	int r;
+
+	if ((r=block_find(0))<0&&nresv>0)
+	{
+		block_unreserve_all();
+		r=block_find(0);
+	}
+	if (r<0)
+		return -E_NO_DISK;//若运行到此,说明没有可用的磁盘块,返回-E_NO_DISK
+	block_take(r);
+	return r;//返回磁盘块
+}
+
+// Allocate a block for file f, which is growing, keeping the file's
+// blocks together on disk.  The first choice is the block after the
+// one f last got (f_hint), then the window of blocks reserved for f
+// in 'pa' (if not NULL), then the start of a free run of 32, then any
+// free block.  After taking a block outside the window, reserve up to
+// PREALLOC free blocks following it as f's new window, so that
+// writers growing other files at the same time take blocks elsewhere.
+// Returns the block number, -E_NO_DISK if the disk is full.
+static int
+file_alloc_block(struct File *f, struct Prealloc *pa)
+{
+	uint32_t goal=f->f_hint,b;
+	int r;
+
+	if (pa&&pa->pa_gen!=resv_gen)   //预留已被全部收回
+		pa->pa_next=pa->pa_end=0;
+	if (pa&&pa->pa_next<pa->pa_end
+	    &&(goal==pa->pa_next||goal==0||!block_is_free(goal)||block_is_reserved(goal)))
+	{
+		r=pa->pa_next++;
+		block_reserve(r,0);
+	}
+	else
 	{
-		if (block_is_free(blockno))//如果该磁盘块空闲
+		if (goal>0&&goal<super->s_nblocks&&block_is_free(goal)&&!block_is_reserved(goal))
+			r=goal;
+		else if ((r=block_find(1))<0&&(r=block_find(0))<0)
+			return alloc_block();   //只剩预留的块了
+		if (pa)
 		{
-			bitmap[blockno/32]^=(1<<(blockno%32));//将blockno对应的bit清0
-			flush_block(bitmap); //将bitmap对应的,修改过的磁盘块写回磁盘
-			return blockno;//返回磁盘块
+			file_release_prealloc(pa);
+			for (b=r+1;b<super->s_nblocks&&b-(r+1)<PREALLOC
+			     &&block_is_free(b)&&!block_is_reserved(b);b++)
+				block_reserve(b,1);
+			pa->pa_next=r+1;
+			pa->pa_end=b;
+			pa->pa_gen=resv_gen;
 		}
 	}
-	return -E_NO_DISK;//若运行到此,说明没有可用的磁盘块,返回-E_NO_DISK
+	block_take(r);
+	f->f_hint=r+1;
+	return r;
+}
+
+//
+// Give back the blocks still reserved in 'pa'.
+//
+void
+file_release_prealloc(struct Prealloc *pa)
+{
+	if (pa->pa_gen==resv_gen)
+		for (;pa->pa_next<pa->pa_end;pa->pa_next++)
+			block_reserve(pa->pa_next,0);
+	pa->pa_next=pa->pa_end=0;
+}
+
+// Count the free blocks each bitmap block covers.
+static void
+bitmap_count(void)
+{
+	uint32_t w, bits, n;
+	uint32_t nwords = ROUNDUP(super->s_nblocks, 32) / 32;
+
+	memset(bitmap_nfree, 0, sizeof(bitmap_nfree));
+	for (w = 0; w < nwords; w++) {
+		bits = bitmap[w];
+		// Bits past the end of the disk do not count.
+		if (w == nwords - 1 && super->s_nblocks % 32)
+			bits &= (1 << (super->s_nblocks % 32)) - 1;
+		for (n = 0; bits; n++)
+			bits &= bits - 1;
+		bitmap_nfree[w / BLKWORDS] += n;
+	}
+	alloc_next = 0;
 }
 
 // Validate the file system bitmap.
@@ -117,18 +285,44 @@ fs_init(void)
 	// Set "super" to point to the super block.
 	super = diskaddr(1);
 	check_super();
+	journal_init();
 
 	// Set "bitmap" to the beginning of the first bitmap block.
 	bitmap = diskaddr(2);
 	check_bitmap();
+	bitmap_count();
 	
 }
 
+// Make sure indirect block 'blockno' is in memory, or if blockno is 0
+// and 'alloc' is set, allocate a cleared one.  Returns the indirect
+// block's number; the caller stores a new one in its slot, logging the
+// slot first (there is room in the journal for it).
+// Errors are as for file_block_walk.
+static int
+indirect_get(uint32_t blockno, bool alloc)
+{
+	int r;
+	if (blockno)
+		return (r=bc_load(blockno))<0 ? r : blockno;  //已有的间接块:先读入缓存
+	if (!alloc)
+		return -E_NOT_FOUND;
+	//若alloc=1,且未分配该间接块
+	journal_need(3); //位图、槽位和新间接块须在同一次提交中
+	r=alloc_block();//分配一个磁盘块
+	if (r<0)
+		return -E_NO_DISK;
+	journal_log(diskaddr(r)); //新间接块也是元数据,随日志写回
+	memset(diskaddr(r),0,BLKSIZE);//将磁盘块清0
+	return r;
+}
+
 // Find the disk block number slot for the 'filebno'th block in file 'f'.
 // Set '*ppdiskbno' to point to that slot.
-// The slot will be one of the f->f_direct[] entries,
-// or an entry in the indirect block.
-// When 'alloc' is set, this function will allocate an indirect block
+// The slot will be one of the f->f_direct[] entries, an entry in the
+// indirect block, or an entry in one of the indirect blocks that the
+// double-indirect block points to.
+// When 'alloc' is set, this function will allocate indirect blocks
 // if necessary.
 //
 // Returns:
@@ -136,7 +330,7 @@ fs_init(void)
 //	-E_NOT_FOUND if the function needed to allocate an indirect block, but
 //		alloc was 0.
 //	-E_NO_DISK if there's no space on the disk for an indirect block.
-//	-E_INVAL if filebno is out of range (it's >= NDIRECT + NINDIRECT).
+//	-E_INVAL if filebno is out of range (it's >= MAXFILESIZE / BLKSIZE).
 //
 // Analogy: This is like pgdir_walk for files.
 // Hint: Don't forget to clear any block you allocate.
@@ -144,7 +338,9 @@ static int
 file_block_walk(struct File *f, uint32_t filebno, uint32_t **ppdiskbno, bool alloc)
 {
        // LAB 5: Your code here.
-	if (filebno>=NDIRECT+NINDIRECT) //如果filebno是否大于一个文件最大的磁盘块数
+	int r;
+	uint32_t *slot;
+	if (filebno>=MAXFILESIZE/BLKSIZE) //如果filebno是否大于一个文件最大的磁盘块数
 		return -E_INVAL;
 	if (filebno<NDIRECT)         //若小于NDIRECT,则直接取FILE结构体中对应的指针即可
 	{
@@ -152,35 +348,48 @@ file_block_walk(struct File *f, uint32_t filebno, uint32_t **ppdiskbno, bool all
 		*ppdiskbno=f->f_direct+filebno;//将对应指针存在ppdiskbno中
 		return 0;
 	}
-	if (!alloc&&!f->f_indirect)
-		return -E_NOT_FOUND; 
-	//若filebno较大,需要另一个磁盘块存储,但目前尚未分配该磁盘块,且alloc=0,返回-E_NOT_FOUND
-	
-	if (!f->f_indirect) //若alloc=1,且未分配indirect block
+	filebno-=NDIRECT;
+	if (filebno<NINDIRECT)      //在一级间接块中
 	{
-		int r=alloc_block();//分配一个磁盘块
-		if (r<0)            
-			return -E_NO_DISK;
-		f->f_indirect=r;       //将f_indirect设为indirect block的磁盘编号
-		memset(diskaddr(r),0,BLKSIZE);//将磁盘块清0
-		flush_block(diskaddr(r)); //做改动后写回
+		if ((r=indirect_get(f->f_indirect,alloc))<0)
+			return r;
+		if (!f->f_indirect)
+		{
+			journal_log(f);
+			f->f_indirect=r;
+		}
+	}
+	else                        //在二级间接块所指的某个间接块中
+	{
+		filebno-=NINDIRECT;
+		if ((r=indirect_get(f->f_dindirect,alloc))<0)
+			return r;
+		if (!f->f_dindirect)
+		{
+			journal_log(f);
+			f->f_dindirect=r;
+		}
+		slot=(uint32_t *) diskaddr(r)+filebno/NINDIRECT;
+		filebno%=NINDIRECT;
+		if ((r=indirect_get(*slot,alloc))<0)
+			return r;
+		if (!*slot)
+		{
+			journal_log(slot);
+			*slot=r;
+		}
 	}
+	//若需要的间接块尚未分配且alloc=0,上面已返回-E_NOT_FOUND
  	if (ppdiskbno)
-		*ppdiskbno=(uint32_t *) diskaddr(f->f_indirect)+filebno-NDIRECT;
+		*ppdiskbno=(uint32_t *) diskaddr(r)+filebno;
 		//将存储对应磁盘块编号的地址存储在ppdiskbno中
 	return 0;
 }
 
-// Set *blk to the address in memory where the filebno'th
-// block of file 'f' would be mapped.
-//
-// Returns 0 on success, < 0 on error.  Errors are:
-//	-E_NO_DISK if a block needed to be allocated but the disk is full.
-//	-E_INVAL if filebno is out of range.
-//
-// Hint: Use file_block_walk and alloc_block.
-int
-file_get_block(struct File *f, uint32_t filebno, char **blk)
+// Like file_get_block, allocating from (and refilling) the reservation
+// window 'pa' if it is not NULL (see file_alloc_block).
+static int
+file_get_block_pa(struct File *f, uint32_t filebno, char **blk, struct Prealloc *pa)
 {
        // LAB 5: Your code here.
 	uint32_t *test;
@@ -189,33 +398,205 @@ file_get_block(struct File *f, uint32_t filebno, char **blk)
 		return t;
 	if (*test==0)//若指针对应的地址中为0,则说明尚未为该文件内的第filebno块分配磁盘块
 	{
-		int r=alloc_block();//分配一个新的磁盘块
+		journal_need(2); //位图与指针须在同一次提交中
+		int r=file_alloc_block(f,pa);//分配一个新的磁盘块,尽量与文件之前的块相邻
 		if (r<0)
 			return -E_NO_DISK;
+		journal_log(test);
 		*test=r;            //通过指针修改对应的磁盘编号
-		memset(diskaddr(r),0,BLKSIZE);//将磁盘块清零
-		flush_block(diskaddr(r));//修改后写回
+		memset(diskaddr(r),0,BLKSIZE);//将磁盘块清零;日志提交前会先写回数据块
+
 	}	
+	else if ((t=bc_load(*test))<0)  //已有的磁盘块:先读入缓存,读盘时可让出给其他请求
+		return t;
 	*blk=diskaddr(*test);//调用diskaddr获得给定磁盘块对应的内存地址
 	return 0;	
 }
 
-// Try to find a file named "name" in dir.  If so, set *file to it.
+// The blocks of a file that may have been written since it was last
+// flushed, so that file_flush need not look at the rest.  Hashed by
+// File; a file that loses its slot to another is flushed then.
+#define NWRITTEN	64
+static struct Written {
+	struct File *wr_file;
+	uint32_t wr_lo, wr_hi;	// File blocks [wr_lo, wr_hi)
+} written[NWRITTEN];
+
+static struct Written *
+written_slot(struct File *f)
+{
+	return &written[(uintptr_t) f / sizeof(struct File) % NWRITTEN];
+}
+
+// Write out the dirty blocks among f's blocks lo to hi - 1, and the
+// blocks holding their pointers.
+static void
+file_flush_blocks(struct File *f, uint32_t lo, uint32_t hi)
+{
+	uint32_t i, *pdiskbno;
+
+	hi = MIN(hi, (f->f_size + BLKSIZE - 1) / BLKSIZE);
+	for (i = lo; i < hi; i++) {
+		if (file_block_walk(f, i, &pdiskbno, 0) < 0 ||
+		    pdiskbno == NULL || *pdiskbno == 0)
+			continue;
+		flush_block(diskaddr(*pdiskbno));
+		flush_block(pdiskbno);
+	}
+}
+
+// Note that blocks lo to hi - 1 of f may be written.
+static void
+file_written(struct File *f, uint32_t lo, uint32_t hi)
+{
+	struct Written *w = written_slot(f), old;
+
+	if (w->wr_file == f) {
+		w->wr_lo = MIN(w->wr_lo, lo);
+		w->wr_hi = MAX(w->wr_hi, hi);
+		return;
+	}
+	// Take the slot before flushing, which may sleep.
+	old = *w;
+	w->wr_file = f;
+	w->wr_lo = lo;
+	w->wr_hi = hi;
+	if (old.wr_file)
+		file_flush_blocks(old.wr_file, old.wr_lo, old.wr_hi);
+}
+
+// Set *blk to the address in memory where the filebno'th
+// block of file 'f' would be mapped.
 //
-// Returns 0 and sets *file on success, < 0 on error.  Errors are:
-//	-E_NOT_FOUND if the file is not found
+// Returns 0 on success, < 0 on error.  Errors are:
+//	-E_NO_DISK if a block needed to be allocated but the disk is full.
+//	-E_INVAL if filebno is out of range.
+//
+// Hint: Use file_block_walk and alloc_block.
+int
+file_get_block(struct File *f, uint32_t filebno, char **blk)
+{
+	int r;
+
+	if ((r = file_get_block_pa(f, filebno, blk, NULL)) == 0)
+		file_written(f, filebno, filebno + 1);
+	return r;
+}
+
+// Buckets in a directory's name index: one block of them.
+#define DIRHASH		(BLKSIZE / 4)
+
+// Where the next free slot of a directory may be, so that creating a
+// file does not rescan the full part of the directory.  Slots are never
+// freed, so every slot below dh_free is in use.  Kept for a few
+// directories at a time, in memory only.
+#define NDIRHINT	64
+static struct DirHint {
+	struct File *dh_dir;
+	uint32_t dh_free;
+} dirhints[NDIRHINT];
+
+static struct DirHint *
+dir_hint(struct File *dir)
+{
+	struct DirHint *h;
+
+	h = &dirhints[(uintptr_t) dir / sizeof(struct File) % NDIRHINT];
+	if (h->dh_dir != dir) {
+		h->dh_dir = dir;
+		h->dh_free = 0;
+	}
+	return h;
+}
+
+static uint32_t
+dir_hash(const char *name)
+{
+	uint32_t h = 2166136261U;
+
+	while (*name)
+		h = (h ^ (uint8_t) *name++) * 16777619;
+	return h % DIRHASH;
+}
+
+// Set *file to the File in slot 'slot' of dir.
 static int
-dir_lookup(struct File *dir, const char *name, struct File **file)
+dir_slot(struct File *dir, uint32_t slot, struct File **file)
+{
+	int r;
+	char *blk;
+
+	if ((r = file_get_block(dir, slot / BLKFILES, &blk)) < 0)
+		return r;
+	*file = (struct File*) blk + slot % BLKFILES;
+	return 0;
+}
+
+// Make sure dir has a name index in memory, building one from the
+// directory's entries if it has none (as directories made by fsformat
+// don't).  Returns 0 on success, < 0 on error; -E_NO_DISK also if the
+// journal has no room for the change.
+static int
+dir_index(struct File *dir)
+{
+	int r;
+	uint32_t blockno, slot, nslot, *bucket;
+	struct File *f;
+
+	if (dir->f_dirindex)
+		return bc_load(dir->f_dirindex);
+
+	// Building it changes every block of the directory, besides the
+	// index, the bitmap and the directory's File.
+	if (!journal_reserve(dir->f_size / BLKSIZE + 3))
+		return -E_NO_DISK;
+	if ((r = alloc_block()) < 0)
+		return r;
+	blockno = r;
+	bucket = diskaddr(blockno);
+	journal_log(bucket);
+	memset(bucket, 0, BLKSIZE);
+	nslot = dir->f_size / BLKSIZE * BLKFILES;
+	for (slot = 0; slot < nslot; slot++) {
+		if ((r = dir_slot(dir, slot, &f)) < 0) {
+			free_block(blockno);
+			return r;
+		}
+		if (f->f_name[0] == '\0')
+			continue;
+		journal_log(f);
+		f->f_hnext = bucket[dir_hash(f->f_name)];
+		bucket[dir_hash(f->f_name)] = slot + 1;
+	}
+	journal_log(dir);
+	dir->f_dirindex = blockno;
+	return 0;
+}
+
+// Add the entry in slot 'slot' of dir, named already, to dir's index.
+static void
+dir_index_add(struct File *dir, struct File *f, uint32_t slot)
+{
+	uint32_t *bucket;
+
+	if (!dir->f_dirindex)
+		return;		// it goes in when the index is built
+	bucket = diskaddr(dir->f_dirindex);
+	journal_log(f);
+	journal_log(bucket);
+	f->f_hnext = bucket[dir_hash(f->f_name)];
+	bucket[dir_hash(f->f_name)] = slot + 1;
+}
+
+// Look for "name" in every entry of dir, for when dir has no index.
+static int
+dir_scan(struct File *dir, const char *name, struct File **file)
 {
 	int r;
 	uint32_t i, j, nblock;
 	char *blk;
 	struct File *f;
 
-	// Search dir for name.
-	// We maintain the invariant that the size of a directory-file
-	// is always a multiple of the file system's block size.
-	assert((dir->f_size % BLKSIZE) == 0);
 	nblock = dir->f_size / BLKSIZE;
 	for (i = 0; i < nblock; i++) {
 		if ((r = file_get_block(dir, i, &blk)) < 0)
@@ -230,36 +611,128 @@ dir_lookup(struct File *dir, const char *name, struct File **file)
 	return -E_NOT_FOUND;
 }
 
-// Set *file to point at a free File structure in dir.  The caller is
-// responsible for filling in the File fields.
+// Try to find a file named "name" in dir.  If so, set *file to it.
+// Only the entries on name's hash chain are compared.
+//
+// Returns 0 and sets *file on success, < 0 on error.  Errors are:
+//	-E_NOT_FOUND if the file is not found
+static int
+dir_lookup(struct File *dir, const char *name, struct File **file)
+{
+	int r;
+	uint32_t s, n, nslot;
+	struct File *f;
+
+	// Search dir for name.
+	// We maintain the invariant that the size of a directory-file
+	// is always a multiple of the file system's block size.
+	assert((dir->f_size % BLKSIZE) == 0);
+	if ((r = dir_index(dir)) < 0)
+		return r == -E_NO_DISK ? dir_scan(dir, name, file) : r;
+
+	nslot = dir->f_size / BLKSIZE * BLKFILES;
+	s = ((uint32_t *) diskaddr(dir->f_dirindex))[dir_hash(name)];
+	for (n = 0; s && s <= nslot && n < nslot; s = f->f_hnext, n++) {
+		if ((r = dir_slot(dir, s - 1, &f)) < 0)
+			return r;
+		if (strcmp(f->f_name, name) == 0) {
+			*file = f;
+			return 0;
+		}
+	}
+	return -E_NOT_FOUND;
+}
+
+// Set *file to point at a free File structure in dir, and *pslot to
+// its slot number.  The caller is responsible for filling in the File
+// fields.  The search starts at the directory's free-slot hint.
 static int
-dir_alloc_file(struct File *dir, struct File **file)
+dir_alloc_file(struct File *dir, struct File **file, uint32_t *pslot)
 {
 	int r;
 	uint32_t nblock, i, j;
 	char *blk;
 	struct File *f;
+	struct DirHint *h;
 
 	assert((dir->f_size % BLKSIZE) == 0);
+	h = dir_hint(dir);
 	nblock = dir->f_size / BLKSIZE;
-	for (i = 0; i < nblock; i++) {
+	for (i = h->dh_free / BLKFILES, j = h->dh_free % BLKFILES; i < nblock; i++, j = 0) {
 		if ((r = file_get_block(dir, i, &blk)) < 0)
 			return r;
 		f = (struct File*) blk;
-		for (j = 0; j < BLKFILES; j++)
+		for (; j < BLKFILES; j++)
 			if (f[j].f_name[0] == '\0') {
 				*file = &f[j];
+				*pslot = i * BLKFILES + j;
+				h->dh_free = *pslot + 1;
 				return 0;
 			}
 	}
+	journal_log(dir);
 	dir->f_size += BLKSIZE;
 	if ((r = file_get_block(dir, i, &blk)) < 0)
 		return r;
 	f = (struct File*) blk;
 	*file = &f[0];
+	*pslot = i * BLKFILES;
+	h->dh_free = *pslot + 1;
 	return 0;
 }
 
+// Path component cache: what dir_lookup last said about a name in a
+// directory, so that walking the same paths again stays in memory.  An
+// entry with a null dc_file records that the name is not there.  It is
+// direct-mapped, so a new entry simply replaces whatever shared its
+// slot.  Names only appear when file_create adds them, and it updates
+// the cache then; anything that removed or renamed an entry would have
+// to call dcache_enter likewise.
+#define NDCACHE		256
+static struct Dentry {
+	struct File *dc_dir;
+	struct File *dc_file;
+	char dc_name[MAXNAMELEN];
+} dcache[NDCACHE];
+
+static struct Dentry *
+dcache_slot(struct File *dir, const char *name)
+{
+	return &dcache[(dir_hash(name) ^ (uintptr_t) dir / sizeof(struct File)) % NDCACHE];
+}
+
+// Record that name in dir is f, or is not there if f is null.
+static void
+dcache_enter(struct File *dir, const char *name, struct File *f)
+{
+	struct Dentry *d;
+
+	d = dcache_slot(dir, name);
+	d->dc_dir = dir;
+	d->dc_file = f;
+	strcpy(d->dc_name, name);
+}
+
+// Look name up in dir through the cache.  Returns as dir_lookup does.
+static int
+dcache_lookup(struct File *dir, const char *name, struct File **file)
+{
+	struct Dentry *d;
+	int r;
+
+	d = dcache_slot(dir, name);
+	if (d->dc_dir == dir && strcmp(d->dc_name, name) == 0) {
+		if (!d->dc_file)
+			return -E_NOT_FOUND;
+		*file = d->dc_file;
+		return 0;
+	}
+	if ((r = dir_lookup(dir, name, file)) < 0 && r != -E_NOT_FOUND)
+		return r;
+	dcache_enter(dir, name, r < 0 ? NULL : *file);
+	return r;
+}
+
 // Skip over slashes.
 static const char*
 skip_slash(const char *p)
@@ -307,7 +780,7 @@ walk_path(const char *path, struct File **pdir, struct File **pf, char *lastelem
 		if (dir->f_type != FTYPE_DIR)
 			return -E_NOT_FOUND;
 
-		if ((r = dir_lookup(dir, name, &f)) < 0) {
+		if ((r = dcache_lookup(dir, name, &f)) < 0) {
 			if (r == -E_NOT_FOUND && *path == '\0') {
 				if (pdir)
 					*pdir = dir;
@@ -329,28 +802,42 @@ walk_path(const char *path, struct File **pdir, struct File **pf, char *lastelem
 // File operations
 // --------------------------------------------------------------
 
-// Create "path".  On success set *pf to point at the file and return 0.
-// On error return < 0.
-int
-file_create(const char *path, struct File **pf)
+static int
+file_create_tx(const char *path, struct File **pf)
 {
 	char name[MAXNAMELEN];
 	int r;
+	uint32_t slot;
 	struct File *dir, *f;
 
 	if ((r = walk_path(path, &dir, &f, name)) == 0)
 		return -E_FILE_EXISTS;
 	if (r != -E_NOT_FOUND || dir == 0)
 		return r;
-	if ((r = dir_alloc_file(dir, &f)) < 0)
+	if ((r = dir_alloc_file(dir, &f, &slot)) < 0)
 		return r;
 
+	journal_log(f);
 	strcpy(f->f_name, name);
+	dir_index_add(dir, f, slot);
+	dcache_enter(dir, name, f);
 	*pf = f;
-	file_flush(dir);
 	return 0;
 }
 
+// Create "path".  On success set *pf to point at the file and return 0.
+// On error return < 0.
+int
+file_create(const char *path, struct File **pf)
+{
+	int r;
+
+	tx_begin();
+	r = file_create_tx(path, pf);
+	tx_end();
+	return r;
+}
+
 // Open "path".  On success set *pf to point at the file and return 0.
 // On error return < 0.
 int
@@ -359,23 +846,70 @@ file_open(const char *path, struct File **pf)
 	return walk_path(path, 0, pf, 0);
 }
 
+// Bring file blocks 'filebno' up to 'end' of f into the cache, reading
+// each run of them that is contiguous on disk with one bc_load_run.
+static void
+file_readahead(struct File *f, uint32_t filebno, uint32_t end)
+{
+	uint32_t *pdiskbno, diskbno, n;
+
+	while (filebno < end) {
+		if (file_block_walk(f, filebno, &pdiskbno, 0) < 0
+		    || (diskbno = *pdiskbno) == 0 || va_is_mapped(diskaddr(diskbno))) {
+			filebno++;
+			continue;
+		}
+		for (n = 1; filebno + n < end && n < RA_MAX; n++)
+			if (file_block_walk(f, filebno + n, &pdiskbno, 0) < 0
+			    || *pdiskbno != diskbno + n
+			    || va_is_mapped(diskaddr(diskbno + n)))
+				break;
+		if (bc_load_run(diskbno, n) < 0)
+			return;
+		filebno += n;
+	}
+}
+
 // Read count bytes from f into buf, starting from seek position
 // offset.  This meant to mimic the standard pread function.
 // Returns the number of bytes read, < 0 on error.
+//
+// If 'ra' is not NULL, it follows how the file is being read.  A read
+// that starts where the last one ended is sequential, and brings in
+// the blocks it needs together with the next ra_window blocks, in as
+// few disk reads as the layout allows.  The window starts at RA_MIN
+// blocks and doubles with each sequential read, up to RA_MAX; any
+// other read drops it.
 ssize_t
-file_read(struct File *f, void *buf, size_t count, off_t offset)
+file_read(struct File *f, void *buf, size_t count, off_t offset,
+	  struct Readahead *ra)
 {
 	int r, bn;
 	off_t pos;
 	char *blk;
+	uint32_t end;
 
 	if (offset >= f->f_size)
 		return 0;
 
 	count = MIN(count, f->f_size - offset);
 
+	if (ra) {
+		if (offset == ra->ra_pos)
+			ra->ra_window = ra->ra_window ? MIN(2 * ra->ra_window, RA_MAX) : RA_MIN;
+		else
+			ra->ra_window = ra->ra_end = 0;
+		ra->ra_pos = offset + count;
+		end = MIN((offset + count - 1) / BLKSIZE + 1 + ra->ra_window,
+			  (f->f_size + BLKSIZE - 1) / BLKSIZE);
+		if (ra->ra_window && ra->ra_end < end) {
+			file_readahead(f, MAX(ra->ra_end, offset / BLKSIZE), end);
+			ra->ra_end = end;
+		}
+	}
+
 	for (pos = offset; pos < offset + count; ) {
-		if ((r = file_get_block(f, pos / BLKSIZE, &blk)) < 0)
+		if ((r = file_get_block_pa(f, pos / BLKSIZE, &blk, NULL)) < 0)
 			return r;
 		bn = MIN(BLKSIZE - pos % BLKSIZE, offset + count - pos);
 		memmove(buf, blk + pos % BLKSIZE, bn);
@@ -389,30 +923,47 @@ file_read(struct File *f, void *buf, size_t count, off_t offset)
 
 // Write count bytes from buf into f, starting at seek position
 // offset.  This is meant to mimic the standard pwrite function.
-// Extends the file if necessary.
+// Extends the file if necessary, taking new blocks from the
+// reservation window 'pa' if it is not NULL (see file_alloc_block).
 // Returns the number of bytes written, < 0 on error.
 int
-file_write(struct File *f, const void *buf, size_t count, off_t offset)
+file_write(struct File *f, const void *buf, size_t count, off_t offset,
+	   struct Prealloc *pa)
 {
 	int r, bn;
 	off_t pos;
 	char *blk;
 
+	tx_begin();
+	r = 0;
 	// Extend file if necessary
 	if (offset + count > f->f_size)
-		if ((r = file_set_size(f, offset + count)) < 0)
-			return r;
+		r = file_set_size(f, offset + count);
+	if (r >= 0 && count > 0)
+		file_written(f, offset / BLKSIZE, (offset + count - 1) / BLKSIZE + 1);
 
-	for (pos = offset; pos < offset + count; ) {
-		if ((r = file_get_block(f, pos / BLKSIZE, &blk)) < 0)
-			return r;
+	for (pos = offset; r >= 0 && pos < offset + count; ) {
+		if ((r = file_get_block_pa(f, pos / BLKSIZE, &blk, pa)) < 0)
+			break;
 		bn = MIN(BLKSIZE - pos % BLKSIZE, offset + count - pos);
 		memmove(blk + pos % BLKSIZE, buf, bn);
 		pos += bn;
 		buf += bn;
 	}
+	tx_end();
 
-	return count;
+	return r < 0 ? r : count;
+}
+
+// Free the block *ptr points to and clear *ptr, both in the same
+// journal commit.
+static void
+free_block_at(uint32_t *ptr)
+{
+	journal_need(2);
+	journal_log(ptr);
+	free_block(*ptr);
+	*ptr = 0;
 }
 
 // Remove a block from file f.  If it's not there, just silently succeed.
@@ -424,11 +975,9 @@ file_free_block(struct File *f, uint32_t filebno)
 	uint32_t *ptr;
 
 	if ((r = file_block_walk(f, filebno, &ptr, 0)) < 0)
-		return r;
-	if (*ptr) {
-		free_block(*ptr);
-		*ptr = 0;
-	}
+		return r == -E_NOT_FOUND ? 0 : r;
+	if (*ptr)
+		free_block_at(ptr);
 	return 0;
 }
 
@@ -439,13 +988,15 @@ file_free_block(struct File *f, uint32_t filebno)
 // If the new_nblocks is no more than NDIRECT, and the indirect block has
 // been allocated (f->f_indirect != 0), then free the indirect block too.
 // (Remember to clear the f->f_indirect pointer so you'll know
-// whether it's valid!)
+// whether it's valid!)  Likewise free the indirect blocks under the
+// double-indirect block that no longer map anything, and the
+// double-indirect block itself once all of them are gone.
 // Do not change f->f_size.
 static void
 file_truncate_blocks(struct File *f, off_t newsize)
 {
 	int r;
-	uint32_t bno, old_nblocks, new_nblocks;
+	uint32_t bno, old_nblocks, new_nblocks, *dind;
 
 	old_nblocks = (f->f_size + BLKSIZE - 1) / BLKSIZE;
 	new_nblocks = (newsize + BLKSIZE - 1) / BLKSIZE;
@@ -454,41 +1005,63 @@ file_truncate_blocks(struct File *f, off_t newsize)
 			cprintf("warning: file_free_block: %e", r);
 
 	if (new_nblocks <= NDIRECT && f->f_indirect) {
+		journal_need(2);
+		journal_log(f);
 		free_block(f->f_indirect);
 		f->f_indirect = 0;
 	}
+	if (f->f_dindirect && bc_load(f->f_dindirect) == 0) {
+		dind = diskaddr(f->f_dindirect);
+		for (bno = 0; bno < NINDIRECT; bno++)
+			if (dind[bno] && NDIRECT + NINDIRECT + bno * NINDIRECT >= new_nblocks)
+				free_block_at(&dind[bno]);
+		if (new_nblocks <= NDIRECT + NINDIRECT) {
+			journal_need(2);
+			journal_log(f);
+			free_block(f->f_dindirect);
+			f->f_dindirect = 0;
+		}
+	}
 }
 
 // Set the size of file f, truncating or extending as necessary.
 int
 file_set_size(struct File *f, off_t newsize)
 {
+	tx_begin();
 	if (f->f_size > newsize)
 		file_truncate_blocks(f, newsize);
+	// Logged after truncating, which may have committed part way.
+	journal_log(f);
 	f->f_size = newsize;
-	flush_block(f);
+	tx_end();
 	return 0;
 }
 
 // Flush the contents and metadata of file f out to disk.
-// Loop over all the blocks in file.
-// Translate the file block number into a disk block number
-// and then check whether that disk block is dirty.  If so, write it out.
+// Only the blocks written since the last flush (see file_written) can
+// be dirty: translate each of their file block numbers into a disk
+// block number and write the block out if it is dirty, along with the
+// block holding its pointer.
+// Nothing to do at all if no block is dirty.
 void
 file_flush(struct File *f)
 {
-	int i;
-	uint32_t *pdiskbno;
+	struct Written *w = written_slot(f);
 
-	for (i = 0; i < (f->f_size + BLKSIZE - 1) / BLKSIZE; i++) {
-		if (file_block_walk(f, i, &pdiskbno, 0) < 0 ||
-		    pdiskbno == NULL || *pdiskbno == 0)
-			continue;
-		flush_block(diskaddr(*pdiskbno));
+	if (bc_dirty_count() == 0)
+		return;
+	if (w->wr_file == f) {
+		w->wr_file = NULL;
+		file_flush_blocks(f, w->wr_lo, w->wr_hi);
 	}
 	flush_block(f);
-	if (f->f_indirect)
-		flush_block(diskaddr(f->f_indirect));
+	if (f->f_type == FTYPE_DIR && f->f_dirindex)
+		flush_block(diskaddr(f->f_dirindex));
+	if (f->f_dindirect)
+		flush_block(diskaddr(f->f_dindirect));
+	// The metadata among those is held for the journal.
+	journal_commit();
 }
 
 
@@ -496,8 +1069,7 @@ file_flush(struct File *f)
 void
 fs_sync(void)
 {
-	int i;
-	for (i = 1; i < super->s_nblocks; i++)
-		flush_block(diskaddr(i));
+	journal_commit();
+	bc_writeback(1);
 }
 
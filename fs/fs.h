@@ -11,8 +11,62 @@
 /* Maximum disk size we can handle (3GB) */
 #define DISKSIZE	0xC0000000
 
+/* Most blocks one ide_read or ide_write moves: 256 sectors */
+#define IOMAXBLKS	(256 / BLKSECTS)
+/* Most blocks one read-ahead brings in */
+#define RA_MAX		IOMAXBLKS
+/* Read-ahead window a sequential reader starts with */
+#define RA_MIN		4
+
+/* Requests the server works on at once.  Each has its own window of
+ * FSDATAMAX bytes below DISKMAP to receive into, and below those each
+ * coroutine has RA_MAX pages for bc_load_run to read blocks into. */
+#define NFSREQ		8
+#define FSREQVA(i)	(DISKMAP - ((i) + 1) * FSDATAMAX)
+#define BCSTAGEVA(i)	(FSREQVA(NFSREQ - 1) - ((i) + 1) * RA_MAX * PGSIZE)
+/* Where a journal commit gathers blocks to write (IOMAXBLKS pages) */
+#define JNLSTAGEVA	(BCSTAGEVA(NCORO - 1) - IOMAXBLKS * PGSIZE)
+
+/* Most blocks the block cache holds at once, not counting the
+ * superblock and bitmap, which it always keeps.  Build with
+ * -DBCSIZE=n to change it. */
+#ifndef BCSIZE
+#define BCSIZE		1024
+#endif
+
+/* Dirty blocks past which the server writes them all back at once,
+ * not waiting for them to age (see bc_writeback) */
+#define WB_MAXDIRTY	(BCSIZE / 4)
+
+/* Block cache counters.  Only lookups made through bc_load count as
+ * hits: any other touch of a cached block never enters the server. */
+struct BcStats {
+	uint32_t bs_hits;
+	uint32_t bs_misses;	// Blocks read in from disk
+	uint32_t bs_evictions;
+	uint32_t bs_readahead;	// Blocks read in before anyone asked
+};
+
+/* Blocks reserved ahead for a growing file (see file_alloc_block) */
+#define PREALLOC	16
+
+/* A window of blocks reserved for one open file being written */
+struct Prealloc {
+	uint32_t pa_next;	// Next block to hand out
+	uint32_t pa_end;	// End of the window
+	uint32_t pa_gen;	// Reservation generation it belongs to
+};
+
+/* How one open file is being read (see file_read) */
+struct Readahead {
+	off_t ra_pos;		// Where the last read ended
+	uint32_t ra_window;	// Blocks to read ahead, 0 if not sequential
+	uint32_t ra_end;	// File block read-ahead has reached
+};
+
 struct Super *super;		// superblock
 uint32_t *bitmap;		// bitmap blocks mapped in memory
+struct BcStats bc_stats;
 
 /* ide.c */
 bool	ide_probe_disk1(void);
@@ -20,21 +74,39 @@ void	ide_set_disk(int diskno);
 void	ide_set_partition(uint32_t first_sect, uint32_t nsect);
 int	ide_read(uint32_t secno, void *dst, size_t nsecs);
 int	ide_write(uint32_t secno, const void *src, size_t nsecs);
+void	ide_intr(void);
 
 /* bc.c */
 void*	diskaddr(uint32_t blockno);
 bool	va_is_mapped(void *va);
 bool	va_is_dirty(void *va);
 void	flush_block(void *addr);
+void	bc_writeback(bool all);
+uint32_t	bc_dirty_count(void);
+int	bc_load(uint32_t blockno);
+int	bc_load_run(uint32_t blockno, uint32_t n);
 void	bc_init(void);
 
+/* journal.c */
+void	journal_init(void);
+void	journal_log(void *va);
+bool	journal_holds(void *va);
+bool	journal_reserve(uint32_t n);
+void	journal_need(uint32_t n);
+void	journal_commit(void);
+void	tx_begin(void);
+void	tx_end(void);
+
 /* fs.c */
 void	fs_init(void);
 int	file_get_block(struct File *f, uint32_t file_blockno, char **pblk);
 int	file_create(const char *path, struct File **f);
 int	file_open(const char *path, struct File **f);
-ssize_t	file_read(struct File *f, void *buf, size_t count, off_t offset);
-int	file_write(struct File *f, const void *buf, size_t count, off_t offset);
+ssize_t	file_read(struct File *f, void *buf, size_t count, off_t offset,
+		  struct Readahead *ra);
+int	file_write(struct File *f, const void *buf, size_t count, off_t offset,
+		   struct Prealloc *pa);
+void	file_release_prealloc(struct Prealloc *pa);
 int	file_set_size(struct File *f, off_t newsize);
 void	file_flush(struct File *f);
 int	file_remove(const char *path);
@@ -43,6 +115,7 @@ void	fs_sync(void);
 /* int	map_block(uint32_t); */
 bool	block_is_free(uint32_t blockno);
 int	alloc_block(void);
+void	free_block(uint32_t blockno);
 
 /* test.c */
 void	fs_test(void);
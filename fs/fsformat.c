@@ -33,6 +33,8 @@ typedef int bool;
 
 #define ROUNDUP(n, v) ((n) - 1 + (v) - ((n) - 1) % (v))
 #define MAX_DIR_ENTS 128
+// The file system server maps at most this many blocks (DISKSIZE in fs/fs.h)
+#define MAX_NBLOCKS (0xC0000000 / BLKSIZE)
 
 struct Dir
 {
@@ -117,6 +119,10 @@ opendisk(const char *name)
 	nbitblocks = (nblocks + BLKBITSIZE - 1) / BLKBITSIZE;
 	bitmap = alloc(nbitblocks * BLKSIZE);
 	memset(bitmap, 0xFF, nbitblocks * BLKSIZE);
+
+	// An empty journal: its header says no blocks are committed.
+	super->s_journal = blockof(alloc(NJOURNAL * BLKSIZE));
+	super->s_njournal = NJOURNAL;
 }
 
 void
@@ -134,17 +140,28 @@ finishdisk(void)
 void
 finishfile(struct File *f, uint32_t start, uint32_t len)
 {
-	int i;
+	int i, j;
+	uint32_t *ind, *dind;
 	f->f_size = len;
 	len = ROUNDUP(len, BLKSIZE);
 	for (i = 0; i < len / BLKSIZE && i < NDIRECT; ++i)
 		f->f_direct[i] = start + i;
 	if (i == NDIRECT) {
-		uint32_t *ind = alloc(BLKSIZE);
+		ind = alloc(BLKSIZE);
 		f->f_indirect = blockof(ind);
-		for (; i < len / BLKSIZE; ++i)
+		for (; i < len / BLKSIZE && i < NDIRECT + NINDIRECT; ++i)
 			ind[i - NDIRECT] = start + i;
 	}
+	if (i == NDIRECT + NINDIRECT && i < len / BLKSIZE) {
+		dind = alloc(BLKSIZE);
+		f->f_dindirect = blockof(dind);
+		for (; i < len / BLKSIZE; ++i) {
+			j = i - NDIRECT - NINDIRECT;
+			if (j % NINDIRECT == 0)
+				dind[j / NINDIRECT] = blockof(ind = alloc(BLKSIZE));
+			ind[j % NINDIRECT] = start + i;
+		}
+	}
 }
 
 void
@@ -161,6 +178,7 @@ diradd(struct Dir *d, uint32_t type, const char *name)
 	struct File *out = &d->ents[d->n++];
 	if (d->n > MAX_DIR_ENTS)
 		panic("too many directory entries");
+	memset(out, 0, sizeof *out);
 	strcpy(out->f_name, name);
 	out->f_type = type;
 	return out;
@@ -228,7 +246,7 @@ main(int argc, char **argv)
 		usage();
 
 	nblocks = strtol(argv[2], &s, 0);
-	if (*s || s == argv[2] || nblocks < 2 || nblocks > 1024)
+	if (*s || s == argv[2] || nblocks < 2 || nblocks > MAX_NBLOCKS)
 		usage();
 
 	opendisk(argv[1]);
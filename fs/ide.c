@@ -1,7 +1,15 @@
 /*
- * Minimal PIO-based (non-interrupt-driven) IDE driver code.
+ * Minimal PIO-based IDE driver code.
  * For information about what all this IDE/ATA magic means,
  * see the materials available on the class references page.
+ *
+ * A coroutine reading the disk sleeps while the drive works, and the
+ * server runs other requests meanwhile.  The drive interrupts when it
+ * has a sector for us; the kernel turns that into a NOTIFY_DISK
+ * notification, and the server calls ide_intr.  Anyone who cannot
+ * sleep (a page fault handler, or code outside any coroutine) polls
+ * instead, finishing any read already in flight before its own.
+ * Writes are always polled.
  */
 
 #include "fs.h"
@@ -14,6 +22,18 @@
 
 static int diskno = 1;
 
+// A read in progress.
+struct IdeRead {
+	char *ir_dst;		// Where the next sector goes
+	size_t ir_nsecs;	// Sectors still to come
+	int ir_r;		// 1 while in progress, then 0 or < 0
+};
+
+// One per coroutine, and one for callers that poll.
+static struct IdeRead ide_reads[NCORO + 1];
+static struct IdeRead *ide_cur;		// Read the drive is working on
+static struct CoroQueue ide_waiters;	// Coroutines waiting on the drive
+
 static int
 ide_wait_ready(bool check_error)
 {
@@ -57,16 +77,60 @@ ide_set_disk(int d)
 	if (d != 0 && d != 1)
 		panic("bad disk number");
 	diskno = d;
+
+	// Clear nIEN, so the drive interrupts.
+	outb(0x3F6, 0);
 }
 
+// Take whatever sectors of the read in flight the drive has ready.
+static void
+ide_poll(void)
+{
+	int r;
+
+	while (ide_cur && ((r = inb(0x1F7)) & (IDE_BSY|IDE_DRDY)) == IDE_DRDY) {
+		if (r & (IDE_DF|IDE_ERR))
+			ide_cur->ir_r = -1;
+		else {
+			insl(0x1F0, ide_cur->ir_dst, SECTSIZE/4);
+			ide_cur->ir_dst += SECTSIZE;
+			if (--ide_cur->ir_nsecs == 0)
+				ide_cur->ir_r = 0;
+		}
+		if (ide_cur->ir_r <= 0) {
+			ide_cur = NULL;
+			coro_wakeup(&ide_waiters);
+		}
+	}
+}
+
+// Wait for the read in flight to make progress, sleeping if we can.
+static void
+ide_wait_read(void)
+{
+	ide_poll();
+	if (ide_cur && coro_can_sleep())
+		coro_sleep(&ide_waiters);
+}
+
+// The drive interrupted: move the read in flight along and let its
+// waiters recheck.
+void
+ide_intr(void)
+{
+	ide_poll();
+	coro_wakeup(&ide_waiters);
+}
 
 int
 ide_read(uint32_t secno, void *dst, size_t nsecs)
 {
-	int r;
+	struct IdeRead *ir;
 
 	assert(nsecs <= 256);
 
+	while (ide_cur)
+		ide_wait_read();
 	ide_wait_ready(0);
 
 	outb(0x1F2, nsecs);
@@ -76,13 +140,14 @@ ide_read(uint32_t secno, void *dst, size_t nsecs)
 	outb(0x1F6, 0xE0 | ((diskno&1)<<4) | ((secno>>24)&0x0F));
 	outb(0x1F7, 0x20);	// CMD 0x20 means read sector
 
-	for (; nsecs > 0; nsecs--, dst += SECTSIZE) {
-		if ((r = ide_wait_ready(1)) < 0)
-			return r;
-		insl(0x1F0, dst, SECTSIZE/4);
-	}
-
-	return 0;
+	ir = &ide_reads[coro_can_sleep() ? coro_id() + 1 : 0];
+	ir->ir_dst = dst;
+	ir->ir_nsecs = nsecs;
+	ir->ir_r = 1;
+	ide_cur = ir;
+	while (ir->ir_r > 0)
+		ide_wait_read();
+	return ir->ir_r;
 }
 
 int
@@ -92,6 +157,8 @@ ide_write(uint32_t secno, const void *src, size_t nsecs)
 
 	assert(nsecs <= 256);
 
+	while (ide_cur)
+		ide_wait_read();
 	ide_wait_ready(0);
 
 	outb(0x1F2, nsecs);
@@ -0,0 +1,208 @@
+/*
+ * Metadata journal.
+ *
+ * Every block of file system metadata (bitmap, File, indirect and
+ * directory index blocks) is entered with journal_log before it is
+ * changed.  From then until the next commit the block is held: the
+ * block cache neither evicts it nor writes it in place.  A commit
+ * writes the data blocks first, then copies of the held blocks into the
+ * journal, then the journal header, which is the commit point; only
+ * then does it write the held blocks in place, and finally clear the
+ * header.  fs_init replays a header left committed by a crash, so the
+ * metadata on disk is always that of some commit.
+ *
+ * The operations that change metadata run as transactions (tx_begin
+ * and tx_end), and a commit only happens between them, so each commit
+ * takes in whole operations: all that have run since the last one.
+ * That happens when the server's write-back tick comes, when a client
+ * syncs or flushes, or when the journal has no room for the next one.
+ */
+
+#include "fs.h"
+
+// Most blocks one transaction logs.  A file_write of FSDATAMAX bytes
+// touches the bitmap, the File and a few indirect blocks.
+#define TX_MAXBLKS	32
+
+static uint32_t jnl_start;		// Header block, 0 if no journal
+static uint32_t jnl_max;		// Most blocks one commit can take
+static uint32_t jnl_blocks[JOURNAL_MAXBLKS];	// The held blocks
+static uint32_t jnl_n;
+static uint32_t jnl_held[DISKSIZE / BLKSIZE / 32];
+static int tx_depth;
+
+// The header as it goes to disk: exactly one sector.
+static struct JournalHeader jnl_hdr;
+
+static void
+journal_write_header(uint32_t n)
+{
+	int r;
+
+	jnl_hdr.jh_magic = JOURNAL_MAGIC;
+	jnl_hdr.jh_n = n;
+	if ((r = ide_write(jnl_start * BLKSECTS, &jnl_hdr, 1)) < 0)
+		panic("journal: writing header: %e", r);
+}
+
+// Write the held blocks out through the journal, as described above.
+static void
+journal_write(void)
+{
+	char *stage = (char *) JNLSTAGEVA;
+	uint32_t i, j, n;
+	int r;
+
+	if (jnl_n == 0)
+		return;
+
+	// Data first, so that committed metadata never points at blocks
+	// whose contents exist only in memory.
+	bc_writeback(1);
+
+	for (i = 0; i < jnl_n; i += n) {
+		n = MIN(IOMAXBLKS, jnl_n - i);
+		for (j = 0; j < n; j++)
+			memmove(stage + j * BLKSIZE, diskaddr(jnl_blocks[i + j]), BLKSIZE);
+		if ((r = ide_write((jnl_start + 1 + i) * BLKSECTS, stage, n * BLKSECTS)) < 0)
+			panic("journal: writing blocks: %e", r);
+	}
+	memmove(jnl_hdr.jh_blocks, jnl_blocks, jnl_n * sizeof(jnl_blocks[0]));
+	journal_write_header(jnl_n);
+
+	// Committed: now the blocks can go in place like any others.
+	for (i = 0; i < jnl_n; i++)
+		jnl_held[jnl_blocks[i] / 32] &= ~(1 << (jnl_blocks[i] % 32));
+	jnl_n = 0;
+	bc_writeback(1);
+	journal_write_header(0);
+}
+
+//
+// Commit every operation finished so far, unless one is in progress
+// (then the next commit will take it).
+//
+void
+journal_commit(void)
+{
+	if (tx_depth == 0)
+		journal_write();
+}
+
+//
+// Make sure the journal can take n more blocks before the next commit,
+// committing now if that is allowed and needed.  Returns false if it
+// cannot.
+//
+bool
+journal_reserve(uint32_t n)
+{
+	if (!jnl_start)
+		return 1;
+	if (jnl_n + n > jnl_max && tx_depth == 0)
+		journal_write();
+	return jnl_n + n <= jnl_max;
+}
+
+//
+// Make sure the next n blocks logged all go into the same commit,
+// committing the operation in progress now if they would not fit.
+// Call it before a change that spans blocks, such as a pointer and
+// the bitmap bit of the block it points to.
+//
+void
+journal_need(uint32_t n)
+{
+	if (jnl_start && jnl_n + n > jnl_max)
+		journal_write();
+}
+
+//
+// Start an operation that changes metadata.  Operations may nest; the
+// outermost one makes room for itself in the journal.
+//
+void
+tx_begin(void)
+{
+	// Reserve first: the journal only commits between transactions.
+	if (tx_depth == 0)
+		journal_reserve(TX_MAXBLKS);
+	tx_depth++;
+}
+
+void
+tx_end(void)
+{
+	assert(tx_depth > 0);
+	tx_depth--;
+}
+
+//
+// Hold the block containing va, which is about to change, until the
+// next commit.  Does nothing if the file system has no journal; then
+// metadata is written back like data.
+//
+void
+journal_log(void *va)
+{
+	uint32_t blockno = ((uint32_t) va - DISKMAP) / BLKSIZE;
+
+	if (!jnl_start || journal_holds(va))
+		return;
+	// A single operation larger than the journal (truncating a huge
+	// file, say) gets committed in parts.
+	if (jnl_n == jnl_max)
+		journal_write();
+	jnl_held[blockno / 32] |= 1 << (blockno % 32);
+	jnl_blocks[jnl_n++] = blockno;
+}
+
+//
+// Is the block containing va held for the next commit?
+//
+bool
+journal_holds(void *va)
+{
+	uint32_t blockno = ((uint32_t) va - DISKMAP) / BLKSIZE;
+
+	return (jnl_held[blockno / 32] & (1 << (blockno % 32))) != 0;
+}
+
+//
+// Find the journal, and replay it if it holds a commit that may not
+// have been written in place.  Must run before anything reads the
+// metadata.
+//
+void
+journal_init(void)
+{
+	struct JournalHeader *h;
+	uint32_t i;
+	int r;
+
+	static_assert(sizeof(struct JournalHeader) == SECTSIZE);
+
+	if (super->s_njournal < 2) {
+		cprintf("file system has no journal\n");
+		return;
+	}
+	jnl_max = MIN(super->s_njournal - 1, JOURNAL_MAXBLKS);
+	for (i = 0; i < IOMAXBLKS; i++)
+		if ((r = sys_page_alloc(0, (void *) JNLSTAGEVA + i * PGSIZE,
+					PTE_P|PTE_U|PTE_W)) < 0)
+			panic("journal_init: %e", r);
+
+	h = diskaddr(super->s_journal);
+	if (h->jh_magic == JOURNAL_MAGIC && h->jh_n > 0) {
+		if (h->jh_n > jnl_max)
+			panic("journal: header lists %d blocks", h->jh_n);
+		for (i = 0; i < h->jh_n; i++)
+			memmove(diskaddr(h->jh_blocks[i]),
+				diskaddr(super->s_journal + 1 + i), BLKSIZE);
+		bc_writeback(1);
+		cprintf("journal: replayed %d blocks\n", h->jh_n);
+	}
+	jnl_start = super->s_journal;
+	journal_write_header(0);
+	cprintf("journal is good\n");
+}
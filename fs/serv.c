@@ -34,6 +34,9 @@ struct OpenFile {
 	struct File *o_file;	// mapped descriptor for open file
 	int o_mode;		// open mode
 	struct Fd *o_fd;	// Fd page
+	bool o_reading;		// a read is using the seek position
+	struct Prealloc o_pa;	// blocks reserved for writes to grow the file
+	struct Readahead o_ra;	// how reads are going, for read-ahead
 };
 
 // Max number of open files in the file system at once
@@ -45,8 +48,116 @@ struct OpenFile opentab[MAXOPEN] = {
 	{ 0, 0, 1, 0 }
 };
 
-// Virtual address at which to receive page mappings containing client requests.
-union Fsipc *fsreq = (union Fsipc *)0x0ffff000;
+// Requests are served in coroutines, so one waiting for the disk does
+// not hold up the rest (see serve).  Each has a window at FSREQVA to
+// receive the page mappings of a client request into: the request
+// itself, or, for requests that arrive in message registers, up to
+// FSDATAMAX bytes of file data.
+struct FsReq {
+	bool fr_busy;		// Slot in use
+	bool fr_done;		// Served; the answer is below
+	envid_t fr_whom;	// Client
+	uint32_t fr_req;	// Request code
+	union Fsipc *fr_ipc;	// The request: fr_page or fr_regs
+	union Fsipc *fr_page;	// Receive window
+	union Fsipc fr_regs;	// Request that came in message registers
+	void *fr_data;		// File data pages, if any
+	size_t fr_datalen;
+	size_t fr_npages;	// Pages received
+	int fr_r;		// Answer
+	void *fr_pg;
+	int fr_perm;
+};
+
+struct FsReq fsreqs[NFSREQ];
+
+// The data pages and the number of pages that came with the request a
+// handler is serving.  Handlers must take them before they can sleep.
+void *fsdata;
+size_t fsdatalen;
+size_t fsnpages;
+
+// Reads and stats run together; requests that change the file system
+// run alone.  Waiting writers hold off new readers.
+static int fs_readers;
+static bool fs_writer;
+static int fs_wwait;
+static struct CoroQueue fs_lockq;
+
+// Reads of one open file take turns, for the sake of its seek position.
+static struct CoroQueue fs_readq;
+
+static void
+fs_lock(bool excl)
+{
+	if (excl) {
+		fs_wwait++;
+		while (fs_writer || fs_readers)
+			coro_sleep(&fs_lockq);
+		fs_wwait--;
+		fs_writer = 1;
+	} else {
+		while (fs_writer || fs_wwait)
+			coro_sleep(&fs_lockq);
+		fs_readers++;
+	}
+}
+
+static void
+fs_unlock(bool excl)
+{
+	if (excl)
+		fs_writer = 0;
+	else
+		fs_readers--;
+	coro_wakeup(&fs_lockq);
+}
+
+// Does request 'req' change the file system?
+static bool
+fs_req_excl(uint32_t req)
+{
+	return req != FSREQ_READ && req != FSREQ_STAT;
+}
+
+// Max number of client channels (FSREQ_CHANNEL) at once, and where
+// their pages are mapped: above the open files' Fd pages, clear of the
+// block cache at DISKMAP and of the coroutine stacks
+#define MAXCHAN		64
+#define CHANVA		(FILEVA + MAXOPEN * PGSIZE)
+
+struct FsChan {
+	envid_t fc_peer;	// Client at the other end, 0 if slot is free
+	bool fc_busy;		// serve_channels is serving a request on it
+	struct Chan fc_chan;
+};
+
+struct FsChan chantab[MAXCHAN];
+
+static char *
+chan_va(struct FsChan *c)
+{
+	return (char *) CHANVA + (c - chantab) * FSCHAN_NPAGES * PGSIZE;
+}
+
+static bool
+env_alive(envid_t envid)
+{
+	const volatile struct Env *e = &envs[ENVX(envid)];
+
+	return e->env_id == envid && e->env_status != ENV_FREE;
+}
+
+// Close channel c, whose client has exited, freeing its slot.
+static void
+chan_close(struct FsChan *c)
+{
+	int i;
+
+	for (i = 0; i < FSCHAN_NPAGES; i++)
+		sys_page_unmap(0, chan_va(c) + i * PGSIZE);
+	c->fc_peer = 0;
+}
 
 void
 serve_init(void)
@@ -58,6 +169,8 @@ serve_init(void)
 		opentab[i].o_fd = (struct Fd*) va;
 		va += PGSIZE;
 	}
+	for (i = 0; i < NFSREQ; i++)
+		fsreqs[i].fr_page = (union Fsipc *) FSREQVA(i);
 }
 
 // Allocate an open file.
@@ -75,6 +188,8 @@ openfile_alloc(struct OpenFile **o)
 			/* fall through */
 		case 1:
 			opentab[i].o_fileid += MAXOPEN;
+			file_release_prealloc(&opentab[i].o_pa);
+			memset(&opentab[i].o_ra, 0, sizeof(opentab[i].o_ra));
 			*o = &opentab[i];
 			memset(opentab[i].o_fd, 0, PGSIZE);
 			return (*o)->o_fileid;
@@ -150,17 +265,13 @@ try_open:
 			return r;
 		}
 	}
-	if ((r = file_open(path, &f)) < 0) {
-		if (debug)
-			cprintf("file_open failed: %e", r);
-		return r;
-	}
 
 	// Save the file pointer
 	o->o_file = f;
 
 	// Fill out the Fd structure
 	o->o_fd->fd_file.id = o->o_fileid;
+	strcpy(o->o_fd->fd_file.name, f->f_name);
 	o->o_fd->fd_omode = req->req_omode & O_ACCMODE;
 	o->o_fd->fd_dev_id = devfile.dev_id;
 	o->o_mode = req->req_omode;
@@ -202,29 +313,36 @@ serve_set_size(envid_t envid, struct Fsreq_set_size *req)
 
 // Read at most ipc->read.req_n bytes from the current seek position
 // in ipc->read.req_fileid.  Return the bytes read from the file to
-// the caller in ipc->readRet, then update the seek position.  Returns
-// the number of bytes successfully read, or < 0 on error.
+// the caller in the data pages it sent (fsdata), then update the seek
+// position.  Returns the number of bytes successfully read, or < 0 on
+// error.
 int
 serve_read(envid_t envid, union Fsipc *ipc)
 {
 	struct Fsreq_read *req = &ipc->read;
-	struct Fsret_read *ret = &ipc->readRet;
 
 	if (debug)
 		cprintf("serve_read %08x %08x %08x\n", envid, req->req_fileid, req->req_n);
 
 	// Lab 5: Your code here:
 	struct OpenFile *o;
+	void *data=fsdata;   //可能要等待,先取出数据页
+	size_t datalen=fsdatalen;
 	int r;
-	if ((r=openfile_lookup(envid,req->req_fileid,&o))<0)
+	while ((r=openfile_lookup(envid,req->req_fileid,&o))==0&&o->o_reading)
+		coro_sleep(&fs_readq);  //同一open file的读请求依次进行
+	if (r<0)
 		return r;        //仿照上面serve_set_size,找到对应的open file
 	int datalength;
-	if (req->req_n>PGSIZE)  
-	//查看inc/fs.h,ipc->readRet中的缓冲区只有PGSIZE个字节,因此一次最多读PGSIZE个字节
-		datalength=PGSIZE;
+	if (req->req_n>datalen)
+	//一次最多读客户端发来的数据页能容纳的字节数
+		datalength=datalen;
 	else 
 		datalength=req->req_n;
-	r=file_read(o->o_file,ret->ret_buf,datalength,o->o_fd->fd_offset);//调用file_read函数
+	o->o_reading=1;
+	r=file_read(o->o_file,data,datalength,o->o_fd->fd_offset,&o->o_ra);//调用file_read函数,读盘时可能让出;顺序读时预读
+	o->o_reading=0;
+	coro_wakeup(&fs_readq);
 	if (r<0) 
 		return r;
 	o->o_fd->fd_offset+=r;//修正该open file的seek position
@@ -232,7 +350,8 @@ serve_read(envid_t envid, union Fsipc *ipc)
 }
 
 
-// Write req->req_n bytes from req->req_buf to req_fileid, starting at
+// Write req->req_n bytes from the data pages sent with the request
+// (fsdata) to req_fileid, starting at
 // the current seek position, and update the seek position
 // accordingly.  Extend the file if necessary.  Returns the number of
 // bytes written, or < 0 on error.
@@ -248,19 +367,19 @@ serve_write(envid_t envid, struct Fsreq_write *req)
 	if ((r=openfile_lookup(envid,req->req_fileid,&o))<0)//获取对应的open file
 		return r;
 	int datalength;
-	if (req->req_n>PGSIZE-sizeof(int)-sizeof(size_t)) //与serve_read中类似,一次最多写缓冲区大小的字节
-		datalength=PGSIZE-sizeof(int)-sizeof(size_t);
+	if (req->req_n>fsdatalen) //与serve_read中类似,一次最多写数据页中的字节
+		datalength=fsdatalen;
 	else 
 		datalength=req->req_n;
-	r=file_write(o->o_file,req->req_buf,datalength,o->o_fd->fd_offset);//调用file_write
+	r=file_write(o->o_file,fsdata,datalength,o->o_fd->fd_offset,&o->o_pa);//调用file_write,新块从该open file的预留窗口中分配
 	if (r<0)
 		return r;
 	o->o_fd->fd_offset+=r;//修改该 open file的seek position
 	return r;
 }
 
-// Stat ipc->stat.req_fileid.  Return the file's struct Stat to the
-// caller in ipc->statRet.
+// Stat ipc->stat.req_fileid.  Return the file's size and type to the
+// caller in ipc->statRet.  (The client takes the name from its Fd.)
 int
 serve_stat(envid_t envid, union Fsipc *ipc)
 {
@@ -275,7 +394,6 @@ serve_stat(envid_t envid, union Fsipc *ipc)
 	if ((r = openfile_lookup(envid, req->req_fileid, &o)) < 0)
 		return r;
 
-	strcpy(ret->ret_name, o->o_file->f_name);
 	ret->ret_size = o->o_file->f_size;
 	ret->ret_isdir = (o->o_file->f_type == FTYPE_DIR);
 	return 0;
@@ -302,6 +420,49 @@ int
 serve_sync(envid_t envid, union Fsipc *req)
 {
 	fs_sync();
+	if (debug)
+		cprintf("block cache: %u hits, %u misses, %u evictions, %u read ahead\n",
+			bc_stats.bs_hits, bc_stats.bs_misses, bc_stats.bs_evictions,
+			bc_stats.bs_readahead);
+	return 0;
+}
+
+// Take the FSCHAN_NPAGES pages sent with this request as a new channel
+// to envid; requests made over it are served by serve_channels.  A
+// client that opens a second channel replaces its first.  Slots of
+// clients that have exited are taken back here too, since
+// serve_channels only runs when some client rings.
+int
+serve_channel(envid_t envid, union Fsipc *ipc)
+{
+	struct FsChan *c, *free;
+	int i, r;
+
+	if (debug)
+		cprintf("serve_channel %08x\n", envid);
+
+	if (fsnpages != FSCHAN_NPAGES)
+		return -E_INVAL;
+	free = NULL;
+	for (c = chantab; c < chantab + MAXCHAN; c++) {
+		if (c->fc_peer == envid)
+			break;
+		if (c->fc_peer && !c->fc_busy && !env_alive(c->fc_peer))
+			chan_close(c);
+		if (c->fc_peer == 0 && !free)
+			free = c;
+	}
+	if (c == chantab + MAXCHAN && !(c = free))
+		return -E_MAX_OPEN;
+
+	c->fc_peer = 0;
+	for (i = 0; i < FSCHAN_NPAGES; i++)
+		if ((r = sys_page_map(0, (char *) ipc + i * PGSIZE,
+				      0, chan_va(c) + i * PGSIZE,
+				      PTE_P | PTE_U | PTE_W | PTE_SHARE)) < 0)
+			return r;
+	chan_init(&c->fc_chan, chan_va(c), envid, 0);
+	c->fc_peer = envid;
 	return 0;
 }
 
@@ -315,48 +476,253 @@ fshandler handlers[] = {
 	[FSREQ_FLUSH] =		(fshandler)serve_flush,
 	[FSREQ_WRITE] =		(fshandler)serve_write,
 	[FSREQ_SET_SIZE] =	(fshandler)serve_set_size,
-	[FSREQ_SYNC] =		serve_sync
+	[FSREQ_SYNC] =		serve_sync,
+	[FSREQ_CHANNEL] =	serve_channel
 };
 
+// Serve the requests waiting on the channels, taking one from each in
+// turn until all are empty, and answer each on the same channel.
+// Channels whose client has exited are closed.  Runs as a coroutine;
+// serve starts it when a client rings, unless it is already running.
+static bool chan_serving;
+
+static void
+serve_channels(void *arg)
+{
+	struct FsChan *c;
+	struct Chanmsg m;
+	union Fsipc regs;
+	bool more, excl;
+	int r;
+
+	do {
+		more = 0;
+		for (c = chantab; c < chantab + MAXCHAN; c++) {
+			if (c->fc_peer == 0)
+				continue;
+			if (!env_alive(c->fc_peer)) {
+				chan_close(c);
+				continue;
+			}
+			// Don't take a request we could not answer without
+			// waiting on the client.
+			if (!chan_can_send(&c->fc_chan)
+			    || !chan_tryrecv(&c->fc_chan, &m))
+				continue;
+			more = 1;
+
+			if (debug)
+				cprintf("fs chan req %d from %08x\n",
+					m.cm_value, c->fc_peer);
+
+			memmove(&regs, m.cm_mr, sizeof(m.cm_mr));
+			if (m.cm_value < ARRAY_SIZE(handlers)
+			    && handlers[m.cm_value]
+			    && m.cm_value != FSREQ_CHANNEL) {
+				excl = fs_req_excl(m.cm_value);
+				c->fc_busy = 1;	// fs_lock may sleep
+				fs_lock(excl);
+				fsdata = chan_va(c) + PGSIZE;
+				fsdatalen = FSCHAN_DATAMAX;
+				fsnpages = 0;
+				r = handlers[m.cm_value](c->fc_peer, &regs);
+				fs_unlock(excl);
+			} else
+				r = -E_INVAL;
+			m.cm_value = r;
+			memmove(m.cm_mr, &regs, sizeof(m.cm_mr));
+			chan_send(&c->fc_chan, &m);
+			c->fc_busy = 0;
+		}
+	} while (more);
+	chan_serving = 0;
+}
+
+// Serve one request, in a coroutine of its own, and leave the answer
+// for serve to send.
+static void
+serve_request(void *arg)
+{
+	struct FsReq *fr = arg;
+	bool excl = fs_req_excl(fr->fr_req);
+	int r;
+
+	fs_lock(excl);
+	fsdata = fr->fr_data;
+	fsdatalen = fr->fr_datalen;
+	fsnpages = fr->fr_npages;
+	fr->fr_pg = NULL;
+	fr->fr_perm = 0;
+	if (fr->fr_req == FSREQ_OPEN) {
+		r = serve_open(fr->fr_whom, (struct Fsreq_open*)fr->fr_ipc,
+			       &fr->fr_pg, &fr->fr_perm);
+	} else if (fr->fr_req < ARRAY_SIZE(handlers) && handlers[fr->fr_req]) {
+		r = handlers[fr->fr_req](fr->fr_whom, fr->fr_ipc);
+	} else {
+		cprintf("Invalid request code %d from %08x\n",
+			fr->fr_req, fr->fr_whom);
+		r = -E_INVAL;
+	}
+	fs_unlock(excl);
+	fr->fr_r = r;
+	fr->fr_done = 1;
+}
+
+// Get fr's answer ready to send and free its slot.  A request that
+// came in registers is answered in them, just as a page request is
+// answered in place on the page.
+static void
+serve_answer(struct FsReq *fr)
+{
+	if (fr->fr_ipc == &fr->fr_regs)
+		ipc_set_mr(&fr->fr_regs, IPC_NMR * sizeof(uint32_t));
+	fr->fr_busy = 0;
+}
+
+// Handle the notification bits 'bits'.
+static void
+serve_notify(uint32_t bits)
+{
+	int r;
+
+	if (bits & NOTIFY_DISK)
+		ide_intr();
+	// Commit the journal and write back the blocks that have been
+	// dirty a while.
+	if (bits & NOTIFY_TIMER) {
+		journal_commit();
+		bc_writeback(0);
+	}
+	// A client has put requests on its channel.
+	if ((bits & NOTIFY_CHAN) && !chan_serving) {
+		if ((r = coro_create(serve_channels, NULL)) < 0) {
+			// Try again later.
+			cprintf("fs: serve_channels: %e\n", r);
+			sys_notify(0, NOTIFY_CHAN);
+		} else
+			chan_serving = 1;
+	}
+}
+
+// The server loop.  Each request is handed to a coroutine, and the
+// coroutines run until every one has finished or is asleep, waiting
+// for the disk or for another request; then we answer the finished
+// ones and receive again.  A notification from the disk wakes the
+// sleepers; so does whatever they were waiting for.
 void
 serve(void)
 {
-	uint32_t req, whom;
+	struct FsReq *fr, *done;
+	uint32_t req;
+	envid_t whom;
+	uint32_t i;
 	int perm, r;
-	void *pg;
 
 	while (1) {
-		perm = 0;
-		req = ipc_recv((int32_t *) &whom, fsreq, &perm);
-		if (debug)
-			cprintf("fs req %d from %08x [page %08x: %s]\n",
-				req, whom, uvpt[PGNUM(fsreq)], fsreq);
-
-		// All requests must contain an argument page
-		if (!(perm & PTE_P)) {
-			cprintf("Invalid request from %08x: no argument page\n",
-				whom);
-			continue; // just leave it hanging...
+		// Too many dirty blocks: write them back now, not on the
+		// next ticks.
+		if (bc_dirty_count() > WB_MAXDIRTY)
+			fs_sync();
+
+		// Answer the finished requests, the last one in the same
+		// system call as the next receive.
+		done = NULL;
+		for (fr = fsreqs; fr < fsreqs + NFSREQ; fr++) {
+			if (!fr->fr_busy || !fr->fr_done)
+				continue;
+			if (done) {
+				serve_answer(done);
+				ipc_send(done->fr_whom, done->fr_r,
+					 done->fr_pg, done->fr_perm);
+			}
+			done = fr;
+		}
+		if (done)
+			done->fr_busy = 0;
+
+		for (fr = fsreqs; fr < fsreqs + NFSREQ; fr++)
+			if (!fr->fr_busy)
+				break;
+		if (fr == fsreqs + NFSREQ) {
+			// No window to receive a request into until one of
+			// the ones we have finishes.
+			serve_notify(sys_wait_notify(NOTIFY_RECV));
+			coro_run();
+			continue;
 		}
 
-		pg = NULL;
-		if (req == FSREQ_OPEN) {
-			r = serve_open(whom, (struct Fsreq_open*)fsreq, &pg, &perm);
-		} else if (req < ARRAY_SIZE(handlers) && handlers[req]) {
-			r = handlers[req](whom, fsreq);
+		// The new request pages simply replace the mappings in the
+		// window; those of an earlier, longer request past them are
+		// unmapped once it has come.
+		if (done) {
+			serve_answer(done);
+			ipc_set_window(FSDATAMAX / PGSIZE);
+			req = ipc_reply_recv(done->fr_whom, done->fr_r,
+					     done->fr_pg, done->fr_perm,
+					     &whom, fr->fr_page, &perm);
 		} else {
-			cprintf("Invalid request code %d from %08x\n", req, whom);
-			r = -E_INVAL;
+			ipc_set_window(FSDATAMAX / PGSIZE);
+			req = ipc_recv(&whom, fr->fr_page, &perm);
+		}
+
+		// A message from envid 0 is a notification; its value
+		// holds the bits.
+		if (whom == 0) {
+			serve_notify(req);
+			coro_run();
+			continue;
 		}
-		ipc_send(whom, r, pg, perm);
-		sys_page_unmap(0, fsreq);
+
+		if (debug)
+			cprintf("fs req %d from %08x [page %08x: %s]\n",
+				req, whom, uvpt[PGNUM(fr->fr_page)], fr->fr_page);
+
+		// Requests come on an argument page, or in the message
+		// registers if they are small enough to fit.  In the latter
+		// case any pages that come along hold the file data.
+		fr->fr_busy = 1;
+		fr->fr_done = 0;
+		fr->fr_whom = whom;
+		fr->fr_req = req;
+		for (i = thisenv->env_ipc_npages; i < fr->fr_npages; i++)
+			if ((r = sys_page_unmap(0, (char *) fr->fr_page + i * PGSIZE)) < 0)
+				panic("serve: sys_page_unmap: %e", r);
+		fr->fr_npages = thisenv->env_ipc_npages;
+		fr->fr_data = NULL;
+		fr->fr_datalen = 0;
+		if ((perm & PTE_P) && thisenv->env_ipc_nmr == 0)
+			fr->fr_ipc = fr->fr_page;
+		else {
+			fr->fr_ipc = &fr->fr_regs;
+			memset(&fr->fr_regs, 0, IPC_NMR * sizeof(uint32_t));
+			ipc_get_mr(&fr->fr_regs, IPC_NMR * sizeof(uint32_t));
+			if (perm & PTE_P) {
+				fr->fr_data = fr->fr_page;
+				fr->fr_datalen = fr->fr_npages * PGSIZE;
+			}
+		}
+		if ((r = coro_create(serve_request, fr)) < 0) {
+			fr->fr_pg = NULL;
+			fr->fr_perm = 0;
+			fr->fr_r = r;
+			fr->fr_done = 1;
+		}
+		coro_run();
 	}
 }
 
 void
 umain(int argc, char **argv)
 {
+	int r;
+
 	static_assert(sizeof(struct File) == 256);
+	static_assert(sizeof(struct Fsreq_set_size) <= IPC_NMR * sizeof(uint32_t));
+	static_assert(sizeof(struct Fsret_stat) <= IPC_NMR * sizeof(uint32_t));
+	static_assert(sizeof(struct Fsreq_write) <= IPC_NMR * sizeof(uint32_t));
+	static_assert(FSDATAMAX <= IPC_MAXPAGES * PGSIZE);
+	static_assert(FILEVA >= DISKMAP + DISKSIZE);
+	static_assert(CHANVA + MAXCHAN * FSCHAN_NPAGES * PGSIZE <= CORO_STACKS);
 	binaryname = "fs";
 	cprintf("FS is running\n");
 
@@ -367,6 +733,8 @@ umain(int argc, char **argv)
 	serve_init();
 	fs_init();
         fs_test();
+	if ((r = sys_register_service(ENV_TYPE_FS)) < 0)
+		panic("sys_register_service: %e", r);
 	serve();
 }
 
@@ -5,6 +5,66 @@
 
 static char *msg = "This is the NEW message of the day!\n\n";
 
+// Drop clean block 'blockno' from the cache, so the next use reads it
+// from disk.
+static void
+bc_forget(uint32_t blockno)
+{
+	int r;
+
+	assert(!va_is_dirty(diskaddr(blockno)));
+	if ((r = sys_page_unmap(0, diskaddr(blockno))) < 0)
+		panic("sys_page_unmap: %e", r);
+}
+
+// Leave a committed transaction in the journal, as a crash right after
+// the commit point would, and check that journal_init replays it.
+// 'buf' is a free page.
+static void
+journal_test(char *buf)
+{
+	struct JournalHeader h;
+	uint32_t jnl, target;
+	int r;
+
+	if (super->s_njournal < 2)
+		return;
+	jnl = super->s_journal;
+	fs_sync();
+	if ((r = alloc_block()) < 0)
+		panic("alloc_block: %e", r);
+	target = r;
+	strcpy(diskaddr(target), "old contents");
+	fs_sync();
+
+	// The logged copy of the block, then the header that commits it.
+	memset(buf, 0, BLKSIZE);
+	strcpy(buf, "replayed contents");
+	if ((r = ide_write((jnl + 1) * BLKSECTS, buf, BLKSECTS)) < 0)
+		panic("ide_write: %e", r);
+	memset(&h, 0, sizeof(h));
+	h.jh_magic = JOURNAL_MAGIC;
+	h.jh_n = 1;
+	h.jh_blocks[0] = target;
+	if ((r = ide_write(jnl * BLKSECTS, &h, 1)) < 0)
+		panic("ide_write: %e", r);
+	bc_forget(jnl);
+	bc_forget(jnl + 1);
+
+	journal_init();
+	bc_forget(target);
+	bc_forget(jnl);
+	if (strcmp(diskaddr(target), "replayed contents") != 0)
+		panic("journal replay wrote \"%s\"", diskaddr(target));
+	if (((struct JournalHeader *) diskaddr(jnl))->jh_n != 0)
+		panic("journal header not cleared after replay");
+	bc_forget(jnl);
+
+	free_block(target);
+	fs_sync();
+	cprintf("journal replay is good\n");
+}
+
 void
 fs_test(void)
 {
@@ -50,11 +110,14 @@ fs_test(void)
 	if ((r = file_set_size(f, 0)) < 0)
 		panic("file_set_size: %e", r);
 	assert(f->f_direct[0] == 0);
-	assert(!(uvpt[PGNUM(f)] & PTE_D));
+	// The File is held for the journal until it commits.
+	fs_sync();
+	assert(!journal_holds(f) && !(uvpt[PGNUM(f)] & PTE_D));
 	cprintf("file_truncate is good\n");
 
 	if ((r = file_set_size(f, strlen(msg))) < 0)
 		panic("file_set_size 2: %e", r);
+	fs_sync();
 	assert(!(uvpt[PGNUM(f)] & PTE_D));
 	if ((r = file_get_block(f, 0, &blk)) < 0)
 		panic("file_get_block 2: %e", r);
@@ -64,4 +127,6 @@ fs_test(void)
 	assert(!(uvpt[PGNUM(blk)] & PTE_D));
 	assert(!(uvpt[PGNUM(f)] & PTE_D));
 	cprintf("file rewrite is good\n");
+
+	journal_test((char *) bits);
 }
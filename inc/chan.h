@@ -0,0 +1,44 @@
+// Shared-memory channels between two environments.
+// See lib/chan.c for the implementation.
+
+#ifndef JOS_INC_CHAN_H
+#define JOS_INC_CHAN_H
+
+#include <inc/types.h>
+#include <inc/env.h>
+
+// Slots per ring; must be a power of two.
+#define CHAN_NSLOTS	32
+
+// One message: an IPC value and message registers, as for ipc_send.
+struct Chanmsg {
+	uint32_t cm_value;
+	uint32_t cm_mr[IPC_NMR];
+};
+
+// Single-producer, single-consumer ring.  cr_head and cr_tail count
+// messages ever produced and consumed; each is written by one side only
+// and kept on its own cache line.
+struct Chanring {
+	volatile uint32_t cr_head;	// Written by the producer
+	char cr_pad0[60];
+	volatile uint32_t cr_tail;	// Written by the consumer
+	char cr_pad1[60];
+	struct Chanmsg cr_slot[CHAN_NSLOTS];
+};
+
+// One end of a channel: a page holding two rings, one each way,
+// shared (PTE_SHARE) with the peer environment.
+struct Chan {
+	envid_t ch_peer;		// Environment at the other end
+	struct Chanring *ch_tx;		// Ring we produce into
+	struct Chanring *ch_rx;		// Ring we consume from
+};
+
+void	chan_init(struct Chan *ch, void *va, envid_t peer, bool creator);
+bool	chan_can_send(struct Chan *ch);
+int	chan_send(struct Chan *ch, const struct Chanmsg *m);
+bool	chan_tryrecv(struct Chan *ch, struct Chanmsg *m);
+int	chan_recv(struct Chan *ch, struct Chanmsg *m);
+
+#endif	// not JOS_INC_CHAN_H
@@ -0,0 +1,26 @@
+// Coroutines: cooperative threads of control inside one environment,
+// each on its own stack.  See lib/coro.c for the implementation.
+
+#ifndef JOS_INC_CORO_H
+#define JOS_INC_CORO_H
+
+#include <inc/types.h>
+#include <inc/memlayout.h>
+
+// Coroutines that may exist at once.
+#define NCORO		32
+
+// Each coroutine has CORO_STKPAGES pages of stack above an unmapped
+// guard page, carved out of the bottom of the user stack region.
+#define CORO_STKPAGES	3
+#define CORO_STACKS	(USTACKTOP - PTSIZE)
+
+struct Coro;
+
+// Coroutines asleep waiting for something, oldest first.
+struct CoroQueue {
+	struct Coro *cq_head;
+	struct Coro *cq_tail;
+};
+
+#endif	// !JOS_INC_CORO_H
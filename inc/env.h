@@ -11,21 +11,25 @@ typedef int32_t envid_t;
 
 // An environment ID 'envid_t' has three parts:
 //
-// +1+---------------21-----------------+--------10--------+
-// |0|          Uniqueifier             |   Environment    |
-// | |                                  |      Index       |
-// +------------------------------------+------------------+
-//                                       \--- ENVX(eid) --/
+// +1+-----------15------------+-2-+--------14--------+
+// |0|        Uniqueifier        | 0 |   Environment    |
+// | |                           |   |      Index       |
+// +-----------------------------+---+------------------+
+//                                    \--- ENVX(eid) --/
 //
 // The environment index ENVX(eid) equals the environment's offset in the
 // 'envs[]' array.  The uniqueifier distinguishes environments that were
 // created at different times, but share the same environment index.
 //
+// envs[] has room for NENV environments but starts out small: the kernel
+// maps it a page at a time as environments are allocated (see env_grow),
+// so only the entries of environments that have existed are readable.
+//
 // All real environments are greater than 0 (so the sign bit is zero).
 // envid_ts less than 0 signify errors.  The envid_t == 0 is special, and
 // stands for the current environment.
 
-#define LOG2NENV		10
+#define LOG2NENV		14
 #define NENV			(1 << LOG2NENV)
 #define ENVX(envid)		((envid) & (NENV - 1))
 
@@ -42,6 +46,38 @@ enum {
 enum EnvType {
 	ENV_TYPE_USER = 0,
 	ENV_TYPE_FS,		// File system server
+	NENVTYPE
+};
+
+// Instances of one EnvType the service registry tracks
+// (see sys_register_service)
+#define NSVCINST	8
+
+// Notification bits (see sys_notify)
+#define NOTIFY_CHAN	0x1	// A channel ring needs attention (lib/chan.c)
+#define NOTIFY_CONS	0x2	// Console input arrived
+#define NOTIFY_PIPE	0x4	// A pipe changed, or an environment exited
+#define NOTIFY_DISK	0x8	// The IDE disk interrupted (fs/ide.c)
+#define NOTIFY_RING	0x10	// Completions were posted to our ring
+#define NOTIFY_TIMER	0x20	// Periodic tick for the FS (kern/trap.c)
+
+// Notification bits that end an IPC receive (see sys_ipc_recv)
+#define NOTIFY_RECV	(NOTIFY_CHAN | NOTIFY_DISK | NOTIFY_TIMER)
+
+// Number of message registers an IPC message carries, in words.
+#define IPC_NMR		8
+// Most pages a single IPC message can transfer.
+#define IPC_MAXPAGES	16
+
+// The message buffer mapped at UIPCBUF.  Before sending, an environment
+// puts the message registers for its next IPC here, and the kernel
+// copies them into the receiver's env_ipc_mr.  The page counts let one
+// IPC map a contiguous range of pages rather than a single page.
+struct IpcBuf {
+	uint32_t ib_nmr;		// Number of words of ib_mr to send
+	uint32_t ib_mr[IPC_NMR];	// Message registers
+	uint32_t ib_npages;		// Pages to send from srcva (0 means 1)
+	uint32_t ib_rcvnpages;		// Pages we accept at dstva (0 means 1)
 };
 
 struct Env {
@@ -54,8 +90,15 @@ struct Env {
 	uint32_t env_runs;		// Number of times environment has run
 	int env_cpunum;			// The CPU that the env is running on
 
+	// FPU/SSE state (see env_fpu_trap)
+	void *env_fpu;			// FXSAVE area (a page), or NULL if
+					// the env never used the FPU
+	int env_fpu_cpu;		// CPU whose FPU registers may hold it
+
 	// Address space
 	pde_t *env_pgdir;		// Kernel virtual address of page dir
+	uint32_t env_pdemask;		// Groups of 32 user PDEs that may hold
+					// page tables (see env_pde_note)
 
 	// Exception handling
 	void *env_pgfault_upcall;	// Page fault upcall entry point
@@ -66,6 +109,35 @@ struct Env {
 	uint32_t env_ipc_value;		// Data value sent to us
 	envid_t env_ipc_from;		// envid of the sender
 	int env_ipc_perm;		// Perm of page mapping received
+	uint32_t env_ipc_npages;	// Number of pages received
+	uint32_t env_ipc_dstnpages;	// Size of the window at env_ipc_dstva
+	uint32_t env_ipc_nmr;		// Number of message registers received
+	uint32_t env_ipc_mr[IPC_NMR];	// Message registers sent to us
+
+	// Blocking IPC send queue (FIFO of envs blocked sending to us)
+	struct Env *env_ipc_sendq;	// First env blocked in sys_ipc_send to us
+	struct Env *env_ipc_sendq_tail;	// Last env blocked in sys_ipc_send to us
+	struct Env *env_ipc_sendq_link;	// Next env in the queue we're blocked on
+	struct Env *env_ipc_sendto;	// Env we're blocked sending to, or NULL
+	uint32_t env_ipc_send_value;	// Value we're blocked sending
+	void *env_ipc_send_srcva;	// VA of page we're blocked sending
+	int env_ipc_send_perm;		// Perm of page we're blocked sending
+	bool env_ipc_calling;		// Receive once our queued send completes
+	void *env_ipc_call_dstva;	// VA at which to map the reply page
+	bool env_ipc_notify;		// NOTIFY_CHAN ends our receive
+
+	// Notifications (see sys_notify)
+	uint32_t env_notify;		// Pending notification bits
+	uint32_t env_notify_wait;	// Bits we're blocked waiting for
+	uint64_t env_notify_seq;	// Broadcasts collected (env_notify_all)
+	struct Env *env_notify_next;	// Next env blocked in sys_wait_notify
+
+	// Futex wait (see sys_futex_wait)
+	physaddr_t env_futex_pa;	// Word we're blocked on, or 0
+	struct Env *env_futex_next;	// Next in its wait queue
+
+	// Submission/completion ring (see sys_ring_setup)
+	struct Ring *env_ring;		// Kernel address of the page, or NULL
 };
 
 #endif // !JOS_INC_ENV_H
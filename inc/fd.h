@@ -25,6 +25,7 @@ struct Dev {
 
 struct FdFile {
 	int id;
+	char name[MAXNAMELEN];	// Set by the file server at open time
 };
 
 struct Fd {
@@ -23,8 +23,12 @@
 #define NDIRECT		10
 // Number of direct block pointers in an indirect block
 #define NINDIRECT	(BLKSIZE / 4)
+// Number of block pointers under a double-indirect block
+#define NDINDIRECT	(NINDIRECT * NINDIRECT)
 
-#define MAXFILESIZE	((NDIRECT + NINDIRECT) * BLKSIZE)
+// The double-indirect block reaches further than an off_t can count, so
+// the limit is the largest whole number of blocks that fits in one.
+#define MAXFILESIZE	0x7FFFF000
 
 struct File {
 	char f_name[MAXNAMELEN];	// filename
@@ -35,10 +39,22 @@ struct File {
 	// A block is allocated iff its value is != 0.
 	uint32_t f_direct[NDIRECT];	// direct blocks
 	uint32_t f_indirect;		// indirect block
+	uint32_t f_dindirect;		// double-indirect block
+
+	// Where to put the next block the file grows by: the disk block
+	// after the last one it got, or 0 for no preference.
+	uint32_t f_hint;
+
+	// Directory name index: the block of hash buckets, 0 if the
+	// directory has none yet (it is built when first needed).  Each
+	// bucket and f_hnext hold an entry's slot in the directory plus 1,
+	// chaining the entries whose names hash alike; 0 ends the chain.
+	uint32_t f_dirindex;
+	uint32_t f_hnext;
 
 	// Pad out to 256 bytes; must do arithmetic in case we're compiling
 	// fsformat on a 64-bit machine.
-	uint8_t f_pad[256 - MAXNAMELEN - 8 - 4*NDIRECT - 4];
+	uint8_t f_pad[256 - MAXNAMELEN - 8 - 4*NDIRECT - 4 - 4 - 4 - 4 - 4];
 } __attribute__((packed));	// required only on some 64-bit machines
 
 // An inode block contains exactly BLKFILES 'struct File's
@@ -57,22 +73,55 @@ struct Super {
 	uint32_t s_magic;		// Magic number: FS_MAGIC
 	uint32_t s_nblocks;		// Total number of blocks on disk
 	struct File s_root;		// Root directory node
+	uint32_t s_journal;		// First block of the journal
+	uint32_t s_njournal;		// Blocks in the journal, 0 if none
+};
+
+// Metadata journal (see fs/journal.c).  The first sector of the
+// journal's first block is a JournalHeader; while jh_n is nonzero, the
+// jh_n blocks after the header block are committed copies of blocks
+// jh_blocks[] that may not have been written in place yet.
+
+#define JOURNAL_MAGIC	0x4A4E4C31	// 'JNL1'
+// Most blocks one header can list: it must fit in one sector, so that
+// writing it is atomic.
+#define JOURNAL_MAXBLKS	((512 - 8) / 4)
+// Blocks fsformat reserves for the journal
+#define NJOURNAL	(1 + JOURNAL_MAXBLKS)
+
+struct JournalHeader {
+	uint32_t jh_magic;		// JOURNAL_MAGIC
+	uint32_t jh_n;			// Blocks committed, 0 if none
+	uint32_t jh_blocks[JOURNAL_MAXBLKS];	// Where each belongs
 };
 
 // Definitions for requests from clients to file system
+
+// Most data one FSREQ_READ or FSREQ_WRITE can move (at most
+// IPC_MAXPAGES pages)
+#define FSDATAMAX	(16 * PGSIZE)
+
 enum {
 	FSREQ_OPEN = 1,
 	FSREQ_SET_SIZE,
-	// Read returns a Fsret_read on the request page
+	// Read and write move the file data in the pages sent along with
+	// the request (up to FSDATAMAX bytes), not on a request page
 	FSREQ_READ,
 	FSREQ_WRITE,
-	// Stat returns a Fsret_stat on the request page
+	// Stat returns a Fsret_stat in the message registers
 	FSREQ_STAT,
 	FSREQ_FLUSH,
 	FSREQ_REMOVE,
-	FSREQ_SYNC
+	FSREQ_SYNC,
+	// Channel sends the FSCHAN_NPAGES pages of a new channel
+	FSREQ_CHANNEL
 };
 
+// Pages in a file server channel: the ring page (see inc/chan.h), then
+// the data window for reads and writes made over the channel.
+#define FSCHAN_NPAGES	16
+#define FSCHAN_DATAMAX	((FSCHAN_NPAGES - 1) * PGSIZE)
+
 union Fsipc {
 	struct Fsreq_open {
 		char req_path[MAXPATHLEN];
@@ -86,19 +135,14 @@ union Fsipc {
 		int req_fileid;
 		size_t req_n;
 	} read;
-	struct Fsret_read {
-		char ret_buf[PGSIZE];
-	} readRet;
 	struct Fsreq_write {
 		int req_fileid;
 		size_t req_n;
-		char req_buf[PGSIZE - (sizeof(int) + sizeof(size_t))];
 	} write;
 	struct Fsreq_stat {
 		int req_fileid;
 	} stat;
 	struct Fsret_stat {
-		char ret_name[MAXNAMELEN];
 		off_t ret_size;
 		int ret_isdir;
 	} statRet;
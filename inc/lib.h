@@ -19,6 +19,10 @@
 #include <inc/trap.h>
 #include <inc/fs.h>
 #include <inc/fd.h>
+#include <inc/chan.h>
+#include <inc/thread.h>
+#include <inc/coro.h>
+#include <inc/ring.h>
 #include <inc/args.h>
 
 #define USED(x)		(void)(x)
@@ -26,9 +30,16 @@
 // main user program
 void	umain(int argc, char **argv);
 
+// Per-environment user data, in a private page at UTCB (sfork shares
+// everything else).  sys_exofork gives each child one; libmain maps it
+// for environments the kernel creates.
+struct Utcb {
+	const volatile struct Env *utcb_env;	// thisenv
+};
+#define thisenv		(((struct Utcb *) UTCB)->utcb_env)
+
 // libmain.c or entry.S
 extern const char *binaryname;
-extern const volatile struct Env *thisenv;
 extern const volatile struct Env envs[NENV];
 extern const volatile struct PageInfo pages[];
 
@@ -56,7 +67,18 @@ int	sys_page_map(envid_t src_env, void *src_pg,
 		     envid_t dst_env, void *dst_pg, int perm);
 int	sys_page_unmap(envid_t env, void *pg);
 int	sys_ipc_try_send(envid_t to_env, uint32_t value, void *pg, int perm);
+int	sys_ipc_send(envid_t to_env, uint32_t value, void *pg, int perm);
 int	sys_ipc_recv(void *rcv_pg);
+int	sys_ipc_call(envid_t to_env, uint32_t value, void *pg, int perm, void *rcv_pg);
+int	sys_ipc_reply_recv(envid_t to_env, uint32_t value, void *pg, int perm, void *rcv_pg);
+int	sys_notify(envid_t envid, uint32_t bits);
+int	sys_wait_notify(uint32_t mask);
+int	sys_register_service(enum EnvType type);
+envid_t	sys_lookup_service(enum EnvType type);
+int	sys_futex_wait(volatile uint32_t *addr, uint32_t val);
+int	sys_futex_wake(volatile uint32_t *addr, int n);
+int	sys_ring_setup(struct Ring *rg);
+int	sys_ring_enter(void);
 
 // This must be inlined.  Exercise for reader: why?
 static inline envid_t __attribute__((always_inline))
@@ -72,12 +94,46 @@ sys_exofork(void)
 // ipc.c
 void	ipc_send(envid_t to_env, uint32_t value, void *pg, int perm);
 int32_t ipc_recv(envid_t *from_env_store, void *pg, int *perm_store);
+int32_t ipc_call(envid_t to_env, uint32_t val, void *pg, int perm,
+		 void *rcv_pg, int *perm_store);
+int32_t ipc_reply_recv(envid_t to_env, uint32_t val, void *pg, int perm,
+		       envid_t *from_env_store, void *rcv_pg, int *perm_store);
 envid_t	ipc_find_env(enum EnvType type);
+void	ipc_set_mr(const void *mr, size_t n);
+size_t	ipc_get_mr(void *mr, size_t n);
+void	ipc_set_pages(size_t npages);
+void	ipc_set_window(size_t npages);
 
 // fork.c
-#define	PTE_SHARE	0x400
 envid_t	fork(void);
-envid_t	sfork(void);	// Challenge!
+envid_t	sfork(void);
+
+// thread.c
+envid_t	thread_create(void (*fn)(void *), void *arg);
+void	thread_exit(void);
+int	thread_join(envid_t tid);
+void	mutex_lock(struct Mutex *m);
+int	mutex_trylock(struct Mutex *m);
+void	mutex_unlock(struct Mutex *m);
+void	cond_wait(struct Cond *c, struct Mutex *m);
+void	cond_signal(struct Cond *c);
+void	cond_broadcast(struct Cond *c);
+
+// coro.c
+int	coro_create(void (*fn)(void *), void *arg);
+void	coro_run(void);
+void	coro_yield(void);
+void	coro_exit(void) __attribute__((noreturn));
+void	coro_sleep(struct CoroQueue *q);
+void	coro_wakeup(struct CoroQueue *q);
+int	coro_id(void);
+bool	coro_can_sleep(void);
+
+// ring.c
+int	ring_setup(struct Ring *rg);
+int	ring_submit(struct Ring *rg, uint32_t tag, uint32_t op, uint32_t a1,
+		    uint32_t a2, uint32_t a3, uint32_t a4, uint32_t a5);
+bool	ring_reap(struct Ring *rg, struct RingCqe *cqe);
 
 // fd.c
 int	close(int fd);
@@ -95,6 +151,7 @@ int	open(const char *path, int mode);
 int	ftruncate(int fd, off_t size);
 int	remove(const char *path);
 int	sync(void);
+int	fs_channel(void);
 
 // pageref.c
 int	pageref(void *addr);
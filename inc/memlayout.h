@@ -23,6 +23,8 @@
  *                                                    kernel/user
  *
  *    4 Gig -------->  +------------------------------+
+ *                     |  Env Table (grows on demand) | RW/--  PTSIZE
+ *    KENVS   ------>  +------------------------------+ 0xffc00000
  *                     |                              | RW/--
  *                     ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
  *                     :              .               :
@@ -86,6 +88,11 @@
 // All physical memory mapped at this address
 #define	KERNBASE	0xF0000000
 
+// The kernel's writable view of the env table, which is mirrored
+// read-only at UENVS.  Physical memory is remapped at KERNBASE only up
+// to here, so the kernel uses at most KENVS - KERNBASE bytes of it.
+#define KENVS		(0xFFFFFFFF - PTSIZE + 1)
+
 // At IOPHYSMEM (640K) there is a 384K hole for I/O.  From the kernel,
 // IOPHYSMEM can be addressed at KERNBASE + IOPHYSMEM.  The hole ends
 // at physical address EXTPHYSMEM.
@@ -135,6 +142,10 @@
 // Used for temporary page mappings for the user page-fault handler
 // (should not conflict with other temporary page mappings)
 #define PFTEMP		(UTEMP + PTSIZE - PGSIZE)
+// Per-environment IPC message buffer (struct IpcBuf)
+#define UIPCBUF		(PFTEMP - PGSIZE)
+// Per-environment user data (struct Utcb in inc/lib.h): not shared by sfork
+#define UTCB		(UIPCBUF - PGSIZE)
 // The location of the user-level STABS data structure
 #define USTABDATA	(PTSIZE / 2)
 
@@ -0,0 +1,45 @@
+// Submission/completion rings: a page an environment shares with the
+// kernel to queue system calls on, instead of trapping for each one.
+// See sys_ring_setup in kern/syscall.c and lib/ring.c.
+
+#ifndef JOS_INC_RING_H
+#define JOS_INC_RING_H
+
+#include <inc/types.h>
+
+// Entries per queue; must be powers of two.  The completion queue is
+// larger, so a full submission queue's worth of completions fits in it
+// with some left waiting to be collected.
+#define RING_NSQE	64
+#define RING_NCQE	128
+
+// A system call to make: one of SYS_page_alloc, SYS_page_map,
+// SYS_page_unmap, SYS_ipc_try_send or SYS_notify, with its arguments
+// as the stub in lib/syscall.c would pass them.
+struct RingSqe {
+	uint32_t sqe_op;
+	uint32_t sqe_tag;		// Handed back in the completion
+	uint32_t sqe_arg[5];
+};
+
+// The result of one submission.
+struct RingCqe {
+	uint32_t cqe_tag;
+	int32_t cqe_res;		// What the system call returned
+};
+
+// The shared page.  Heads and tails count entries ever submitted and
+// completed; each is written by one side only, and the kernel's are
+// kept apart from the environment's.
+struct Ring {
+	volatile uint32_t rg_sqhead;	// Written by the kernel
+	volatile uint32_t rg_cqtail;	// Written by the kernel
+	char rg_pad0[56];
+	volatile uint32_t rg_sqtail;	// Written by the environment
+	volatile uint32_t rg_cqhead;	// Written by the environment
+	char rg_pad1[56];
+	struct RingSqe rg_sq[RING_NSQE];
+	struct RingCqe rg_cq[RING_NCQE];
+};
+
+#endif	// !JOS_INC_RING_H
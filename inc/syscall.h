@@ -17,6 +17,17 @@ enum {
 	SYS_yield,
 	SYS_ipc_try_send,
 	SYS_ipc_recv,
+	SYS_ipc_send,
+	SYS_ipc_call,
+	SYS_ipc_reply_recv,
+	SYS_notify,
+	SYS_wait_notify,
+	SYS_register_service,
+	SYS_lookup_service,
+	SYS_futex_wait,
+	SYS_futex_wake,
+	SYS_ring_setup,
+	SYS_ring_enter,
 	NSYSCALLS
 };
 
@@ -0,0 +1,26 @@
+// Threads: environments made with sfork, sharing memory, and the
+// futex-backed locks they synchronize with.
+// See lib/thread.c for the implementation.
+
+#ifndef JOS_INC_THREAD_H
+#define JOS_INC_THREAD_H
+
+#include <inc/types.h>
+
+// Threads that may exist (and not yet be joined) at once.
+#define NTHREAD		64
+
+// 0: unlocked, 1: locked, 2: locked and maybe contended.
+struct Mutex {
+	volatile uint32_t mu_state;
+};
+
+// Bumped on every signal; waiters sleep on it.
+struct Cond {
+	volatile uint32_t cv_seq;
+};
+
+#define MUTEX_INITIALIZER	{ 0 }
+#define COND_INITIALIZER	{ 0 }
+
+#endif	// !JOS_INC_THREAD_H
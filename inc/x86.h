@@ -185,6 +185,24 @@ rcr4(void)
 	return cr4;
 }
 
+static inline void
+clts(void)
+{
+	asm volatile("clts");
+}
+
+static inline void
+fxsave(void *area)
+{
+	asm volatile("fxsave %0" : "=m" (*(uint8_t (*)[512]) area));
+}
+
+static inline void
+fxrstor(const void *area)
+{
+	asm volatile("fxrstor %0" : : "m" (*(const uint8_t (*)[512]) area));
+}
+
 static inline void
 tlbflush(void)
 {
@@ -240,6 +258,15 @@ cpuid(uint32_t info, uint32_t *eaxp, uint32_t *ebxp, uint32_t *ecxp, uint32_t *e
 		*edxp = edx;
 }
 
+// Index of the lowest set bit of x, which must not be 0.
+static inline uint32_t
+bsf(uint32_t x)
+{
+	uint32_t i;
+	asm("bsfl %1,%0" : "=r" (i) : "rm" (x) : "cc");
+	return i;
+}
+
 static inline uint64_t
 read_tsc(void)
 {
@@ -22,6 +22,7 @@ struct CpuInfo {
 	uint8_t cpu_id;                 // Local APIC ID; index into cpus[] below
 	volatile unsigned cpu_status;   // The status of the CPU
 	struct Env *cpu_env;            // The currently-running environment.
+	struct Env *cpu_fpu_env;        // Last env whose FPU state was loaded
 	struct Taskstate cpu_ts;        // Used by x86 to find stack for interrupt
 };
 
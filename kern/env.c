@@ -14,12 +14,39 @@
 #include <kern/sched.h>
 #include <kern/cpu.h>
 #include <kern/spinlock.h>
+#include <kern/futex.h>
 
 struct Env *envs = NULL;		// All environments
+size_t nenv;				// envs[0..nenv) are mapped
 static struct Env *env_free_list;	// Free environment list
 					// (linked by Env->env_link)
+static struct Env *env_reap_list;	// Freed, memory not yet reclaimed
+					// (see env_free; linked the same)
 
-#define ENVGENSHIFT	12		// >= LOGNENV
+// Broadcast notifications (see env_notify_all)
+static struct Env *notify_waiters;	// Blocked in sys_wait_notify
+static uint64_t notify_all_seq;		// Broadcasts so far
+static uint64_t notify_all_last[32];	// Broadcast that last posted each bit
+static uint32_t notify_all_bits;	// Bits ever broadcast
+static void env_notify_unwait(struct Env *e);
+
+#define ENVGENSHIFT	16		// >= LOGNENV
+
+// Service registry: the environments serving each EnvType, so clients
+// find a server without scanning envs[].  svc_next rotates lookups
+// across the instances of a type.
+static struct Env *svc_inst[NENVTYPE][NSVCINST];
+static int svc_ninst[NENVTYPE];
+static int svc_next[NENVTYPE];
+
+// New page directories start as a copy of pgdir_template: kern_pgdir
+// above UTOP, empty below.  Page directories of freed environments,
+// whose user half env_free has just emptied, are kept on pgdir_cache
+// (linked by pp_link) and reused as they are.
+#define PGDIR_CACHE_MAX	16
+static pde_t *pgdir_template;
+static struct PageInfo *pgdir_cache;
+static int pgdir_ncache;
 
 // Global descriptor table.
 //
@@ -87,6 +114,10 @@ envid2env(envid_t envid, struct Env **env_store, bool checkperm)
 	// to ensure that the envid is not stale
 	// (i.e., does not refer to a _previous_ environment
 	// that used the same slot in the envs[] array).
+	if (ENVX(envid) >= nenv) {
+		*env_store = 0;
+		return -E_BAD_ENV;
+	}
 	e = &envs[ENVX(envid)];
 	
 	if (e->env_status == ENV_FREE || e->env_id != envid) {
@@ -109,6 +140,43 @@ envid2env(envid_t envid, struct Env **env_store, bool checkperm)
 	return 0;
 }
 
+//
+// Grow envs[] by one page: map a fresh zeroed page after the last one,
+// at KENVS for the kernel and read-only at UENVS for everyone, and put
+// the environments it completes on the free list, in envs[] order.
+// Environments may straddle pages, so a page can complete none or many.
+//
+// Returns 0 on success, < 0 on failure.  Errors include:
+//	-E_NO_FREE_ENV if envs[] already holds NENV environments
+//	-E_NO_MEM on memory exhaustion
+//
+static int
+env_grow(void)
+{
+	static size_t mapped;		// bytes of envs[] mapped
+	struct PageInfo *pp;
+	struct Env **link;
+	size_t n;
+
+	if (nenv == NENV)
+		return -E_NO_FREE_ENV;
+	if (!(pp = page_alloc(ALLOC_ZERO)))
+		return -E_NO_MEM;
+	if (page_insert(kern_pgdir, pp, (void *) (KENVS + mapped), PTE_W) < 0
+	    || page_insert(kern_pgdir, pp, (void *) (UENVS + mapped), PTE_U) < 0)
+		panic("env_grow: envs page tables missing");
+	mapped += PGSIZE;
+
+	n = MIN(mapped / sizeof(struct Env), NENV);
+	for (link = &env_free_list; *link; link = &(*link)->env_link)
+		;
+	for (; nenv < n; nenv++) {
+		*link = &envs[nenv];
+		link = &envs[nenv].env_link;
+	}
+	return 0;
+}
+
 // Mark all environments in 'envs' as free, set their env_ids to 0,
 // and insert them into the env_free_list.
 // Make sure the environments are in the free list in the same order
@@ -120,17 +188,17 @@ env_init(void)
 {
 	// Set up envs array
 	// LAB 3: Your code here.
-	int i;
-	for (int i=0;i<NENV;i++)
-	{
-		envs[i].env_id=0;        //根据要求,将envs_ids设为0,进行初始化
-		if (i!=NENV-1)
-		{
-			envs[i].env_link=&envs[i+1]; 
-	//由于要求environments在free_list中的顺序与在envs数组中顺序相同,每个envs[i]的env_link指向envs[i+1]
-		}
-	}
-	env_free_list=&envs[0]; //env_free_list指向envs数组的第一个
+	// envs[]开始时为空,按需以页为单位增长(见env_grow),新页已清零
+	if (env_grow()<0)
+		panic("env_init: cannot map envs");
+	// 建立页目录模板:UTOP以上与kern_pgdir相同,以下为空
+	struct PageInfo *p=page_alloc(ALLOC_ZERO);
+	if (!p)
+		panic("env_init: cannot allocate pgdir template");
+	p->pp_ref++;
+	pgdir_template=page2kva(p);
+	memcpy(pgdir_template+PDX(UTOP),kern_pgdir+PDX(UTOP),
+	       (NPDENTRIES-PDX(UTOP))*sizeof(pde_t));
 	// Per-CPU part of the initialization
 	env_init_percpu();
 }
@@ -169,11 +237,17 @@ env_init_percpu(void)
 static int
 env_setup_vm(struct Env *e)
 {
-	int i;
 	struct PageInfo *p = NULL;
 
-	// Allocate a page for the page directory
-	if (!(p = page_alloc(ALLOC_ZERO)))
+	// Reuse a cached page directory, which is already set up,
+	// or allocate one and copy the template into it.
+	if ((p = pgdir_cache)) {
+		pgdir_cache = p->pp_link;
+		p->pp_link = NULL;
+		pgdir_ncache--;
+	} else if ((p = page_alloc(0)))
+		memcpy(page2kva(p), pgdir_template, PGSIZE);
+	else
 		return -E_NO_MEM;
 
 	// Now, set e->env_pgdir and initialize the page directory.
@@ -194,11 +268,8 @@ env_setup_vm(struct Env *e)
 
 	// LAB 3: Your code here.
 	e->env_pgdir=page2kva(p);
-	for (i=PDX(UTOP);i<1024;i++)
-	{
-		e->env_pgdir[i]=kern_pgdir[i];    
-		//由于UTOP及以上的地址对于各个进程及kernel均相同,所以之间使用Kern_pgdir即可
-	}
+	//UTOP及以上的PDE已由模板复制,指向与kern_pgdir相同的页表
+	e->env_pdemask=0;
 	p->pp_ref++;           //根据要求,修改引用次数
 	
 	// UVPT maps the env's own page table read-only.
@@ -209,33 +280,46 @@ env_setup_vm(struct Env *e)
 	return 0;
 }
 
+//
+// Return the next env_id for slot e: same index, next generation.
+//
+static envid_t
+env_next_id(struct Env *e)
+{
+	int32_t generation;
+
+	generation = (e->env_id + (1 << ENVGENSHIFT)) & ~(NENV - 1);
+	if (generation <= 0)	// Don't create a negative env_id.
+		generation = 1 << ENVGENSHIFT;
+	return generation | (e - envs);
+}
+
 //
 // Allocates and initializes a new environment.
 // On success, the new environment is stored in *newenv_store.
 //
 // Returns 0 on success, < 0 on failure.  Errors include:
-//	-E_NO_FREE_ENV if all NENVS environments are allocated
+//	-E_NO_FREE_ENV if all NENV environments are allocated
 //	-E_NO_MEM on memory exhaustion
 //
 int
 env_alloc(struct Env **newenv_store, envid_t parent_id)
 {
-	int32_t generation;
 	int r;
 	struct Env *e;
 
-	if (!(e = env_free_list))
-		return -E_NO_FREE_ENV;   
+	// Reclaim a dead environment's slot if there is one, else grow
+	// envs[] until a page completes an environment.
+	while (!(e = env_free_list))
+		if (env_reap(1) == 0 && (r = env_grow()) < 0)
+			return r;
 
 	// Allocate and set up the page directory for this environment.
 	if ((r = env_setup_vm(e)) < 0)
 		return r;
 
 	// Generate an env_id for this environment.
-	generation = (e->env_id + (1 << ENVGENSHIFT)) & ~(NENV - 1);
-	if (generation <= 0)	// Don't create a negative env_id.
-		generation = 1 << ENVGENSHIFT;
-	e->env_id = generation | (e - envs);
+	e->env_id = env_next_id(e);
 
 	// Set the basic status variables.
 	e->env_parent_id = parent_id;
@@ -273,6 +357,31 @@ env_alloc(struct Env **newenv_store, envid_t parent_id)
 	// Also clear the IPC receiving flag.
 	e->env_ipc_recving = 0;
 
+	// And the IPC send queue state.
+	e->env_ipc_sendq = NULL;
+	e->env_ipc_sendq_tail = NULL;
+	e->env_ipc_sendq_link = NULL;
+	e->env_ipc_sendto = NULL;
+	e->env_ipc_calling = 0;
+	e->env_ipc_notify = 0;
+
+	// Not waiting on a futex.
+	e->env_futex_pa = 0;
+	e->env_futex_next = NULL;
+
+	// No ring until the env sets one up.
+	e->env_ring = NULL;
+
+	// No FPU state until the env uses the FPU.
+	e->env_fpu = NULL;
+	e->env_fpu_cpu = -1;
+
+	// No notifications yet, not even earlier broadcasts.
+	e->env_notify = 0;
+	e->env_notify_wait = 0;
+	e->env_notify_seq = notify_all_seq;
+	e->env_notify_next = NULL;
+
 	// commit the allocation
 	env_free_list = e->env_link;
 	*newenv_store = e;
@@ -302,6 +411,7 @@ region_alloc(struct Env *e, void *va, size_t len)
 		{
 			panic("allocation error");
 		}
+		env_pde_note(e,(void *)i);
 		page_insert(e->env_pgdir,p,(void *)i,PTE_U|PTE_W); //使用page_insert,将刚分配的物理页映射到虚拟地址
 	}	
 	
@@ -400,6 +510,7 @@ load_icode(struct Env *e, uint8_t *binary)
 	struct PageInfo *p=page_alloc(0);                   
 	if (!p)
 		panic("allocation fail!");
+	env_pde_note(e,(void *)USTACKTOP-PGSIZE);
 	page_insert(e->env_pgdir,p,(void *)USTACKTOP-PGSIZE, PTE_U|PTE_W);	   
 	//为该用户程序分配栈空间
 	// LAB 3: Your code here.
@@ -430,6 +541,8 @@ env_create(uint8_t *binary, enum EnvType type)
 		e->env_type=type;   //设置该env对应的类型
 		if (type==ENV_TYPE_FS)
 		e->env_tf.tf_eflags|=FL_IOPL_MASK;
+		if (type!=ENV_TYPE_USER&&svc_register(e,type)<0)  //特殊进程自动登记为服务
+			panic("env_create: too many instances of type %d",type);
 		load_icode(e,binary);	 //加载对应二进制文件
 	}
 	else 
@@ -439,16 +552,312 @@ env_create(uint8_t *binary, enum EnvType type)
 //>>>>>>> lab4
 }
 
+//
+// Add e to the registry as an instance of service 'type'.
+// Returns 0 on success (including if e is already registered),
+// -E_NO_MEM if the type already has NSVCINST instances.
+//
+int
+svc_register(struct Env *e, enum EnvType type)
+{
+	int i;
+
+	for (i = 0; i < svc_ninst[type]; i++)
+		if (svc_inst[type][i] == e)
+			return 0;
+	if (svc_ninst[type] == NSVCINST)
+		return -E_NO_MEM;
+	svc_inst[type][svc_ninst[type]++] = e;
+	return 0;
+}
+
+//
+// Return the envid of an instance of service 'type', taking the
+// instances in turn, or 0 if there is none.
+//
+envid_t
+svc_lookup(enum EnvType type)
+{
+	int n;
+
+	if ((n = svc_ninst[type]) == 0)
+		return 0;
+	if (svc_next[type] >= n)
+		svc_next[type] = 0;
+	return svc_inst[type][svc_next[type]++]->env_id;
+}
+
+//
+// Post notification 'bits' to every instance of service 'type'.
+//
+void
+svc_notify(enum EnvType type, uint32_t bits)
+{
+	int i;
+
+	for (i = 0; i < svc_ninst[type]; i++)
+		env_notify(svc_inst[type][i], bits);
+}
+
+//
+// Drop e from the registry.
+//
+static void
+svc_unregister(struct Env *e)
+{
+	int i;
+
+	if (e->env_type == ENV_TYPE_USER)
+		return;
+	for (i = 0; i < svc_ninst[e->env_type]; i++)
+		if (svc_inst[e->env_type][i] == e) {
+			svc_inst[e->env_type][i] =
+				svc_inst[e->env_type][--svc_ninst[e->env_type]];
+			return;
+		}
+}
+
+//
+// Detach env e from blocking IPC sends before it is freed:
+// take e off the send queue of the env it is blocked sending to, if any,
+// and fail every send still queued on e with -E_BAD_ENV.
+//
+static void
+env_ipc_cancel(struct Env *e)
+{
+	struct Env *s, *p, *prev;
+
+	if ((s = e->env_ipc_sendto) != NULL) {
+		prev = NULL;
+		for (p = s->env_ipc_sendq; p && p != e; p = p->env_ipc_sendq_link)
+			prev = p;
+		if (p) {
+			if (prev)
+				prev->env_ipc_sendq_link = e->env_ipc_sendq_link;
+			else
+				s->env_ipc_sendq = e->env_ipc_sendq_link;
+			if (s->env_ipc_sendq_tail == e)
+				s->env_ipc_sendq_tail = prev;
+		}
+		e->env_ipc_sendto = NULL;
+		e->env_ipc_sendq_link = NULL;
+	}
+
+	while ((s = e->env_ipc_sendq) != NULL) {
+		e->env_ipc_sendq = s->env_ipc_sendq_link;
+		s->env_ipc_sendq_link = NULL;
+		s->env_ipc_sendto = NULL;
+		s->env_ipc_calling = 0;
+		s->env_tf.tf_regs.reg_eax = -E_BAD_ENV;
+		s->env_status = ENV_RUNNABLE;
+	}
+	e->env_ipc_sendq_tail = NULL;
+}
+
+//
+// If e is receiving and takes notifications while it does
+// (env_ipc_notify), and any NOTIFY_RECV bits are pending, consume them
+// and end the receive with an empty message from envid 0 whose value
+// is those bits.
+// Leaves e's status alone.  Returns 1 if the receive ended, 0 otherwise.
+//
+int
+env_recv_notify(struct Env *e)
+{
+	uint32_t bits;
+
+	if (!e->env_ipc_notify || !(bits = e->env_notify & NOTIFY_RECV))
+		return 0;
+	e->env_notify &= ~bits;
+	e->env_ipc_recving = 0;
+	e->env_ipc_from = 0;
+	e->env_ipc_value = bits;
+	e->env_ipc_perm = 0;
+	e->env_ipc_npages = 0;
+	e->env_ipc_nmr = 0;
+	return 1;
+}
+
+//
+// Post notification 'bits' to e.  Bits coalesce in e->env_notify until e
+// collects them.  If e is blocked in sys_wait_notify for any of them, it
+// is woken with those bits; if it is receiving, see env_recv_notify.
+//
+void
+env_notify(struct Env *e, uint32_t bits)
+{
+	uint32_t got;
+
+	env_notify_collect(e);
+	e->env_notify |= bits;
+	if ((got = e->env_notify & e->env_notify_wait) != 0) {
+		e->env_notify &= ~got;
+		env_notify_unwait(e);
+		e->env_tf.tf_regs.reg_eax = got;
+		e->env_status = ENV_RUNNABLE;
+	} else if (e->env_ipc_recving && env_recv_notify(e)) {
+		e->env_tf.tf_regs.reg_eax = 0;
+		e->env_status = ENV_RUNNABLE;
+	}
+}
+
+//
+// Post notification 'bits' to every environment.  Used for events that
+// have no single waiter we know of; waiters recheck their condition, so
+// spurious bits are harmless.
+//
+// Only the environments blocked in sys_wait_notify for the bits are
+// touched now.  The rest find the bits pending when they next look
+// (env_notify_collect): each broadcast bit records the broadcast that
+// last posted it, and each environment how many it has collected.
+//
+void
+env_notify_all(uint32_t bits)
+{
+	struct Env *e, *next;
+	int i;
+
+	notify_all_seq++;
+	for (i = 0; i < 32; i++)
+		if (bits & (1 << i))
+			notify_all_last[i] = notify_all_seq;
+	notify_all_bits |= bits;
+	for (e = notify_waiters; e; e = next) {
+		next = e->env_notify_next;
+		if (e->env_notify_wait & bits)
+			env_notify(e, bits);
+	}
+}
+
+//
+// Add the broadcast bits posted since e last looked to e's pending bits.
+//
+void
+env_notify_collect(struct Env *e)
+{
+	int i;
+
+	if (e->env_notify_seq == notify_all_seq)
+		return;
+	for (i = 0; i < 32; i++)
+		if ((notify_all_bits & (1 << i))
+		    && notify_all_last[i] > e->env_notify_seq)
+			e->env_notify |= 1 << i;
+	e->env_notify_seq = notify_all_seq;
+}
+
+//
+// Block curenv in sys_wait_notify until a bit in 'mask' is posted.
+//
+void
+env_notify_wait(uint32_t mask)
+{
+	// Still listed if sys_env_set_status woke it instead of a bit.
+	if (curenv->env_notify_wait)
+		env_notify_unwait(curenv);
+	curenv->env_notify_wait = mask;
+	curenv->env_notify_next = notify_waiters;
+	notify_waiters = curenv;
+	curenv->env_status = ENV_NOT_RUNNABLE;
+}
+
+// Take e off the list of environments blocked in sys_wait_notify.
+static void
+env_notify_unwait(struct Env *e)
+{
+	struct Env **pp;
+
+	e->env_notify_wait = 0;
+	for (pp = &notify_waiters; *pp; pp = &(*pp)->env_notify_next)
+		if (*pp == e) {
+			*pp = e->env_notify_next;
+			break;
+		}
+	e->env_notify_next = NULL;
+}
+
+//
+// FPU/SSE state is switched lazily.  env_run sets CR0_TS unless this
+// CPU's FPU registers already hold the new environment's state, so the
+// environment's first FPU or SSE instruction traps (T_DEVICE) to
+// env_fpu_trap, which loads its state.  Environments that never use
+// the FPU never trap and have no state to save.  When an environment
+// that used the FPU leaves a CPU, env_fpu_leave saves its registers to
+// env_fpu, so it can resume on any CPU.
+//
+
+//
+// Save curenv's FPU registers to curenv->env_fpu if it has them
+// loaded on this CPU.  Call before curenv leaves the CPU.
+//
+void
+env_fpu_leave(void)
+{
+	if (curenv && thiscpu->cpu_fpu_env == curenv && !(rcr0() & CR0_TS))
+		fxsave(curenv->env_fpu);
+}
+
+//
+// Handle T_DEVICE: curenv used the FPU with CR0_TS set.  Load its FPU
+// state, starting from the reset state (with every register cleared,
+// so nothing leaks from the last user) the first time.
+//
+void
+env_fpu_trap(void)
+{
+	struct PageInfo *pp;
+	uint8_t *fx;
+
+	clts();
+	if (!curenv->env_fpu) {
+		if (!(pp = page_alloc(ALLOC_ZERO))) {
+			cprintf("[%08x] no memory for FPU state\n", curenv->env_id);
+			env_destroy(curenv);
+			return;
+		}
+		pp->pp_ref++;
+		fx = page2kva(pp);
+		*(uint16_t *) (fx + 0) = 0x037F;	// FCW: all exceptions masked
+		*(uint32_t *) (fx + 24) = 0x1F80;	// MXCSR: same
+		curenv->env_fpu = fx;
+	}
+	fxrstor(curenv->env_fpu);
+	thiscpu->cpu_fpu_env = curenv;
+	curenv->env_fpu_cpu = cpunum();
+}
+
+//
+// Give dst a copy of src's FPU state, as fork would.
+// src must be curenv.  Returns 0 on success, -E_NO_MEM.
+//
+int
+env_fpu_copy(struct Env *dst, struct Env *src)
+{
+	struct PageInfo *pp;
+
+	if (!src->env_fpu)
+		return 0;
+	if (!(pp = page_alloc(0)))
+		return -E_NO_MEM;
+	pp->pp_ref++;
+	env_fpu_leave();
+	dst->env_fpu = page2kva(pp);
+	memcpy(dst->env_fpu, src->env_fpu, 512);
+	return 0;
+}
+
 //
 // Frees env e and all memory it uses.
 //
+// Only the cheap part happens now: e stops existing (its status is
+// ENV_FREE and envid2env no longer finds it) and goes on the reap
+// queue.  env_reap frees its memory later, on an idle CPU or a little
+// at each scheduling decision, and only then puts the slot back on the
+// free list.
+//
 void
 env_free(struct Env *e)
 {
-	pte_t *pt;
-	uint32_t pdeno, pteno;
-	physaddr_t pa;
-
 	// If freeing the current environment, switch to kern_pgdir
 	// before freeing the page directory, just in case the page
 	// gets reused.
@@ -458,10 +867,51 @@ env_free(struct Env *e)
 	// Note the environment's demise.
 	// cprintf("[%08x] free env %08x\n", curenv ? curenv->env_id : 0, e->env_id);
 
+	// Nobody may stay blocked sending to or from a dead environment.
+	env_ipc_cancel(e);
+	svc_unregister(e);
+	if (thiscpu->cpu_fpu_env == e)
+		thiscpu->cpu_fpu_env = NULL;
+	futex_dequeue(e);
+	if (e->env_notify_wait)
+		env_notify_unwait(e);
+	if (e->env_ring) {
+		page_decref(pa2page(PADDR(e->env_ring)));
+		e->env_ring = NULL;
+	}
+
+	// Retire e's envid, and wake anyone waiting for it to change
+	// (wait() in lib/wait.c).
+	e->env_status = ENV_FREE;
+	e->env_id = env_next_id(e);
+	futex_wake_kva(&e->env_id, NENV);
+
+	e->env_link = env_reap_list;
+	env_reap_list = e;
+}
+
+//
+// Free the memory of an environment env_free queued, and put it on the
+// free list.  e's page directory must not be loaded on any CPU.
+//
+static void
+env_reap_one(struct Env *e)
+{
+	pte_t *pt;
+	uint32_t pdeno, pteno;
+	physaddr_t pa;
+	struct PageInfo *pp;
+
 	// Flush all mapped pages in the user portion of the address space
 	static_assert(UTOP % PTSIZE == 0);
 	for (pdeno = 0; pdeno < PDX(UTOP); pdeno++) {
 
+		// skip groups of PDEs that never held page tables
+		if (!(e->env_pdemask & (1 << (pdeno / 32)))) {
+			pdeno |= 31;
+			continue;
+		}
+
 		// only look at mapped page tables
 		if (!(e->env_pgdir[pdeno] & PTE_P))
 			continue;
@@ -481,17 +931,50 @@ env_free(struct Env *e)
 		page_decref(pa2page(pa));
 	}
 
-	// free the page directory
-	pa = PADDR(e->env_pgdir);
+	// free the page directory, or cache it: it is all template now
+	pp = pa2page(PADDR(e->env_pgdir));
 	e->env_pgdir = 0;
-	page_decref(pa2page(pa));
+	e->env_pdemask = 0;
+	if (pp->pp_ref == 1 && pgdir_ncache < PGDIR_CACHE_MAX) {
+		pp->pp_ref = 0;
+		pp->pp_link = pgdir_cache;
+		pgdir_cache = pp;
+		pgdir_ncache++;
+	} else
+		page_decref(pp);
+
+	if (e->env_fpu) {
+		page_decref(pa2page(PADDR(e->env_fpu)));
+		e->env_fpu = NULL;
+	}
 
 	// return the environment to the free list
-	e->env_status = ENV_FREE;
 	e->env_link = env_free_list;
 	env_free_list = e;
 }
 
+//
+// Free the memory of up to 'max' environments on the reap queue.
+// Returns how many were freed.
+//
+int
+env_reap(int max)
+{
+	struct Env *e;
+	int n;
+
+	for (n = 0; n < max && (e = env_reap_list); n++) {
+		env_reap_list = e->env_link;
+		env_reap_one(e);
+	}
+
+	// Wake pipe waiters: the dead may have held the other end of
+	// their pipe without getting to close it.
+	if (n > 0)
+		env_notify_all(NOTIFY_PIPE);
+	return n;
+}
+
 //
 // Frees environment e.
 // If e was the current env, then runs a new environment (and does not return
@@ -573,9 +1056,16 @@ env_run(struct Env *e)
 		//根据要求,如果当前environment的状态为RUNNING,将其该为RUNNABLE
 			curenv->env_status=ENV_RUNNABLE;
 	}
+	if (curenv!=e)
+		env_fpu_leave();  //保存离开的environment的FPU状态
 	curenv=e;               //将当前environment设为对应的e 
 	curenv->env_status=ENV_RUNNING; //修改状态为RUNNING
 	curenv->env_runs++;      //更新计数器值
+	//FPU寄存器中已是e的状态则直接使用,否则设置TS,等第一次使用时再加载
+	if (thiscpu->cpu_fpu_env==e&&e->env_fpu_cpu==cpunum())
+		clts();
+	else
+		lcr0(rcr0()|CR0_TS);
 	unlock_kernel();
 	lcr3(PADDR(e->env_pgdir));  
 	//将e->env_pgdir装入CR3寄存器,从而切换至该environment对应的地址空间
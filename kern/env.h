@@ -7,6 +7,17 @@
 #include <kern/cpu.h>
 
 extern struct Env *envs;		// All environments
+extern size_t nenv;			// Number of mapped envs[] entries
+
+// Note that e may get a page table for 'va' below UTOP, so env_free
+// looks there.  Call before anything that may create one in
+// e->env_pgdir (page_insert, pgdir_walk with create).
+#define PDEGROUP(va)	(PDX(va) / 32)
+static inline void
+env_pde_note(struct Env *e, const void *va)
+{
+	e->env_pdemask |= 1 << PDEGROUP(va);
+}
 #define curenv (thiscpu->cpu_env)		// Current environment
 extern struct Segdesc gdt[];
 
@@ -14,10 +25,22 @@ void	env_init(void);
 void	env_init_percpu(void);
 int	env_alloc(struct Env **e, envid_t parent_id);
 void	env_free(struct Env *e);
+int	env_reap(int max);
+void	env_fpu_leave(void);
+void	env_fpu_trap(void);
+int	env_fpu_copy(struct Env *dst, struct Env *src);
 void	env_create(uint8_t *binary, enum EnvType type);
 void	env_destroy(struct Env *e);	// Does not return if e == curenv
 
 int	envid2env(envid_t envid, struct Env **env_store, bool checkperm);
+void	env_notify(struct Env *e, uint32_t bits);
+void	env_notify_all(uint32_t bits);
+void	env_notify_collect(struct Env *e);
+void	env_notify_wait(uint32_t mask);
+int	env_recv_notify(struct Env *e);
+int	svc_register(struct Env *e, enum EnvType type);
+envid_t	svc_lookup(enum EnvType type);
+void	svc_notify(enum EnvType type, uint32_t bits);
 // The following two functions do not return
 void	env_run(struct Env *e) __attribute__((noreturn));
 void	env_pop_tf(struct Trapframe *tf) __attribute__((noreturn));
@@ -0,0 +1,96 @@
+// Wait queues for sys_futex_wait and sys_futex_wake.
+//
+// Environments blocked on a word are kept in a FIFO queue, linked
+// through env_futex_next, in a hash table keyed by the physical address
+// of the word.  Keying on the physical address makes every mapping of
+// a page (sfork, PTE_SHARE, envs[] at UENVS) name the same words.
+
+#include <inc/assert.h>
+#include <inc/mmu.h>
+
+#include <kern/env.h>
+#include <kern/pmap.h>
+#include <kern/futex.h>
+
+#define FUTEX_NHASH	64		// Must be a power of two
+
+static struct Env *futex_queue[FUTEX_NHASH];
+
+static inline struct Env **
+futex_bucket(physaddr_t pa)
+{
+	return &futex_queue[((pa >> 2) ^ (pa >> PGSHIFT)) & (FUTEX_NHASH - 1)];
+}
+
+//
+// Put e at the tail of the queue for the word at physical address pa.
+// The caller blocks e.
+//
+void
+futex_enqueue(struct Env *e, physaddr_t pa)
+{
+	struct Env **link;
+
+	assert(!e->env_futex_pa);
+	for (link = futex_bucket(pa); *link; link = &(*link)->env_futex_next)
+		;
+	e->env_futex_pa = pa;
+	e->env_futex_next = NULL;
+	*link = e;
+}
+
+//
+// Take e off the queue it is waiting on, if any.
+//
+void
+futex_dequeue(struct Env *e)
+{
+	struct Env **link;
+
+	if (!e->env_futex_pa)
+		return;
+	for (link = futex_bucket(e->env_futex_pa); *link != e;
+	     link = &(*link)->env_futex_next)
+		assert(*link);
+	*link = e->env_futex_next;
+	e->env_futex_pa = 0;
+	e->env_futex_next = NULL;
+}
+
+//
+// Wake up to n environments waiting on the word at physical address pa,
+// oldest first.  Returns the number woken.
+//
+int
+futex_wake(physaddr_t pa, int n)
+{
+	struct Env **link, *e;
+	int woken = 0;
+
+	link = futex_bucket(pa);
+	while (woken < n && (e = *link)) {
+		if (e->env_futex_pa != pa) {
+			link = &e->env_futex_next;
+			continue;
+		}
+		*link = e->env_futex_next;
+		e->env_futex_pa = 0;
+		e->env_futex_next = NULL;
+		e->env_status = ENV_RUNNABLE;
+		woken++;
+	}
+	return woken;
+}
+
+//
+// futex_wake for a word the kernel names by its kernel virtual address.
+//
+int
+futex_wake_kva(const void *kva, int n)
+{
+	pte_t *pte;
+
+	if (!(pte = pgdir_walk(kern_pgdir, kva, 0)) || !(*pte & PTE_P))
+		return 0;
+	return futex_wake(PTE_ADDR(*pte) + PGOFF(kva), n);
+}
@@ -0,0 +1,16 @@
+/* See COPYRIGHT for copyright information. */
+
+#ifndef JOS_KERN_FUTEX_H
+#define JOS_KERN_FUTEX_H
+#ifndef JOS_KERNEL
+# error "This is a JOS kernel header; user programs should not #include it"
+#endif
+
+#include <inc/env.h>
+
+void	futex_enqueue(struct Env *e, physaddr_t pa);
+void	futex_dequeue(struct Env *e);
+int	futex_wake(physaddr_t pa, int n);
+int	futex_wake_kva(const void *kva, int n);
+
+#endif	// !JOS_KERN_FUTEX_H
@@ -57,6 +57,12 @@ i386_detect_memory(void)
 
 	cprintf("Physical memory: %uK available, base = %uK, extended = %uK\n",
 		totalmem, basemem, totalmem - basemem);
+
+	// Memory we can't remap below KENVS is no use to us.
+	if (npages > (KENVS - KERNBASE) / PGSIZE) {
+		npages = (KENVS - KERNBASE) / PGSIZE;
+		cprintf("Physical memory: using only %uK\n", npages * (PGSIZE / 1024));
+	}
 }
 
 
@@ -167,7 +173,10 @@ mem_init(void)
 	//////////////////////////////////////////////////////////////////////
 	// Make 'envs' point to an array of size 'NENV' of 'struct Env'.
 	// LAB 3: Your code here.
-	envs=(struct Env*) boot_alloc(sizeof(struct Env)*NENV);
+	// The array lives at KENVS and env_init maps pages under it as
+	// it grows, so only its page tables are set up here (below).
+	static_assert(NENV * sizeof(struct Env) <= PTSIZE);
+	envs=(struct Env*) KENVS;
 	//////////////////////////////////////////////////////////////////////
 	// Now that we've allocated the initial kernel data structures, we set
 	// up the list of free physical pages. Once we've done so, all further
@@ -200,7 +209,12 @@ mem_init(void)
 	//    - the new image at UENVS  -- kernel R, user R
 	//    - envs itself -- kernel RW, user NONE
 	// LAB 3: Your code here.
-	boot_map_region(kern_pgdir,UENVS,ROUNDUP(sizeof(struct Env)*NENV,PGSIZE),PADDR(envs),PTE_U|PTE_P);
+	// envs grows a page at a time (see env_grow), mapped at both KENVS and
+	// UENVS in kern_pgdir.  Create both page tables now, so every env's
+	// page directory (copied from kern_pgdir) shares them and sees the
+	// table grow.
+	if (!pgdir_walk(kern_pgdir,(void *)UENVS,1)||!pgdir_walk(kern_pgdir,(void *)KENVS,1))
+		panic("mem_init: no memory for envs page tables");
 
 	//根据要求,将envs数组映射至线性地址UENVS处,权限为用户可读
 	//////////////////////////////////////////////////////////////////////
@@ -248,8 +262,8 @@ mem_init(void)
 		pabegin+=PTSIZE;
 	}*/      
 	
-	boot_map_region(kern_pgdir,KERNBASE,ROUNDUP(0xffffffff-KERNBASE,PGSIZE),0,PTE_P|PTE_W);
-	//根据要求,将0开始的物理地址映射到虚拟地址KERNBASE开始,大小为2^32-KERNBASE
+	boot_map_region(kern_pgdir,KERNBASE,KENVS-KERNBASE,0,PTE_P|PTE_W);
+	//根据要求,将0开始的物理地址映射到虚拟地址KERNBASE开始,大小为KENVS-KERNBASE(KENVS以上留给envs数组)
 //>>>>>>> lab3
 	// Check that the initial page directory has been set up correctly.
 	check_kern_pgdir();
@@ -393,13 +407,16 @@ page_init(void)
 // Be sure to set the pp_link field of the allocated page to NULL so
 // page_free can check for double-free bugs.
 //
-// Returns NULL if out of free memory.
+// Returns NULL if out of free memory.  Dead environments' memory counts
+// as free: it is reaped (see env_free) before giving up.
 //
 // Hint: use page2kva and memset
 struct PageInfo *
 page_alloc(int alloc_flags)
 {
 	// Fill this function in
+	while (!page_free_list && env_reap(1) > 0)  //先回收等待回收的环境的内存
+		/* do nothing */;
 	if (!page_free_list)                        //如果当前没有可用页面,返回NULL
 	{
 		return NULL;
@@ -928,9 +945,10 @@ check_kern_pgdir(void)
 		assert(check_va2pa(pgdir, UPAGES + i) == PADDR(pages) + i);
 
 	// check envs array (new test for lab 3)
-	n = ROUNDUP(NENV*sizeof(struct Env), PGSIZE);
-	for (i = 0; i < n; i += PGSIZE)
-		assert(check_va2pa(pgdir, UENVS + i) == PADDR(envs) + i);
+	// (it is empty until env_init grows it)
+	assert(envs == (struct Env *) KENVS);
+	assert(check_va2pa(pgdir, UENVS) == ~0);
+	assert(check_va2pa(pgdir, KENVS) == ~0);
 
 	// check phys mem
 	for (i = 0; i < npages * PGSIZE; i += PGSIZE)
@@ -4,9 +4,13 @@
 #include <kern/env.h>
 #include <kern/pmap.h>
 #include <kern/monitor.h>
+#include <kern/syscall.h>
 
 void sched_halt(void);
 
+// Environments env_reap frees at a time while this CPU is idle
+#define REAP_BATCH	32
+
 // Choose a user environment to run and run it.
 void
 sched_yield(void)
@@ -28,6 +32,10 @@ sched_yield(void)
 	// no runnable environments, simply drop through to the code
 	// below to halt the cpu.
 
+	// Reclaim one dead environment on every scheduling decision, so
+	// the reap queue drains even if no CPU ever goes idle.
+	env_reap(1);
+
 	// LAB 4: Your code here.
 	int i,cur=0;
 	if (curenv)    //如果有environment正在当前CPU上运行
@@ -38,9 +46,9 @@ sched_yield(void)
 	{	
 		cur=0;   //否则将cur设为0
 	}
-	for (i=0;i<NENV;i++) //从当前正在运行的environment或者0遍历envs数组
+	for (i=0;i<nenv;i++) //从当前正在运行的environment或者0遍历envs数组
 	{
-		int j=(cur+i)%NENV;          
+		int j=(cur+i)%nenv;          
 		if (envs[j].env_status==ENV_RUNNABLE)//如果有可以运行的environment
 		{
 			env_run(envs+j); //运行该environment
@@ -56,6 +64,31 @@ sched_yield(void)
 	sched_halt();
 }
 
+// Carry out the ring submissions (see sys_ring_setup) of blocked
+// environments, in each one's address space, as if it had trapped in.
+// Returns the number carried out.
+static int
+sched_drain_rings(void)
+{
+	int i, n;
+
+	n = 0;
+	for (i = 0; i < nenv; i++) {
+		if (envs[i].env_status != ENV_NOT_RUNNABLE
+		    || !ring_pending(&envs[i]))
+			continue;
+		env_fpu_leave();
+		curenv = &envs[i];
+		lcr3(PADDR(curenv->env_pgdir));
+		n += ring_drain();
+	}
+	if (n > 0) {
+		curenv = NULL;
+		lcr3(PADDR(kern_pgdir));
+	}
+	return n;
+}
+
 // Halt this CPU when there is nothing to do. Wait until the
 // timer interrupt wakes it up. This function never returns.
 //
@@ -64,21 +97,37 @@ sched_halt(void)
 {
 	int i;
 
+	// Nothing to run, so this CPU reclaims dead environments, a batch
+	// at a time.  Reaping wakes pipe waiters, so look for work after
+	// every batch.
+	while (env_reap(REAP_BATCH) > 0)
+		for (i = 0; i < nenv; i++)
+			if (envs[i].env_status == ENV_RUNNABLE)
+				sched_yield();
+
+	// Likewise for ring submissions, which may send messages or
+	// notifications that wake their targets.
+	if (sched_drain_rings() > 0)
+		for (i = 0; i < nenv; i++)
+			if (envs[i].env_status == ENV_RUNNABLE)
+				sched_yield();
+
 	// For debugging and testing purposes, if there are no runnable
 	// environments in the system, then drop into the kernel monitor.
-	for (i = 0; i < NENV; i++) {
+	for (i = 0; i < nenv; i++) {
 		if ((envs[i].env_status == ENV_RUNNABLE ||
 		     envs[i].env_status == ENV_RUNNING ||
 		     envs[i].env_status == ENV_DYING))
 			break;
 	}
-	if (i == NENV) {
+	if (i == nenv) {
 		cprintf("No runnable environments in the system!\n");
 		while (1)
 			monitor(NULL);
 	}
 
 	// Mark that no environment is running on this CPU
+	env_fpu_leave();
 	curenv = NULL;
 	lcr3(PADDR(kern_pgdir));
 
@@ -4,6 +4,7 @@
 #include <inc/error.h>
 #include <inc/string.h>
 #include <inc/assert.h>
+#include <inc/ring.h>
 
 #include <kern/env.h>
 #include <kern/pmap.h>
@@ -11,6 +12,7 @@
 #include <kern/syscall.h>
 #include <kern/console.h>
 #include <kern/sched.h>
+#include <kern/futex.h>
 
 // Print a string to the system console.
 // The string is exactly 'len' characters long.
@@ -81,12 +83,33 @@ sys_exofork(void)
 
 	// LAB 4: Your code here.
 	struct Env *e;
+	struct PageInfo *pp;
 	int t=env_alloc(&e,curenv->env_id);
 	//使用env_alloc分配一个新的environment
 	
 	if (t)   //如果返回值不为0,说明出错,返回对应的错误信息
 		return t;
 	
+	if ((t=env_fpu_copy(e,curenv))<0)  //子进程继承FPU状态
+	{
+		env_free(e);
+		return t;
+	}
+	// Every child gets its own UTCB page (see inc/lib.h), however the
+	// parent goes on to build its address space, so it can set
+	// thisenv.  fork replaces it with a copy of the parent's.
+	if (!(pp=page_alloc(ALLOC_ZERO)))
+	{
+		env_free(e);
+		return -E_NO_MEM;
+	}
+	env_pde_note(e,(void *) UTCB);
+	if ((t=page_insert(e->env_pgdir,pp,(void *) UTCB,PTE_U|PTE_W))<0)
+	{
+		page_free(pp);
+		env_free(e);
+		return t;
+	}
 	e->env_status=ENV_NOT_RUNNABLE;//设置新的environment状态为不可运行
 	e->env_tf=curenv->env_tf; //复制当前environment的寄存器组值至新的environement
 	e->env_tf.tf_regs.reg_eax=0;//将新的environment中的eax寄存器设为0,从而使运行该
@@ -118,6 +141,7 @@ sys_env_set_status(envid_t envid, int status)
 	if (t)      //如果返回值不为0,说ing该envid无效,返回-E_BAD_ENV
 		return -E_BAD_ENV;
 	e->env_status=status;
+	futex_dequeue(e);   //不再等待futex
 	return 0;
 	
 	
@@ -208,6 +232,7 @@ sys_page_alloc(envid_t envid, void *va, int perm)
 	papage=page_alloc(ALLOC_ZERO);  //分配一个新页
 	if (papage==NULL)    //如果返回NULL,说明没有足够内存,返回-E_NO_MEN
 		return -E_NO_MEM;
+	env_pde_note(e,va);
 	t=page_insert(e->env_pgdir,papage,va,perm);
 	//将该页插入envid对应的environment的地址空间中虚拟地址va处
 	
@@ -271,6 +296,7 @@ sys_page_map(envid_t srcenvid, void *srcva,
 		return -E_INVAL;
 	if (((*pagetableentry&PTE_W)==0)&&(perm&PTE_W)) //如果将只读页映射为可写页,返回-E_INVAL
 		return -E_INVAL;
+	env_pde_note(dstenv,dstva);
 	t=page_insert(dstenv->env_pgdir,tpage,dstva,perm);//在目的environment中插入该页
 	if (t)    //若插入失败,说明内存不足,返回-E_NO_MEM
 		return -E_NO_MEM;
@@ -300,9 +326,151 @@ sys_page_unmap(envid_t envid, void *va)
 	return 0;	
 }
 
+// Check the page that 'src' wants to send at 'srcva' with 'perm'.
+// On success, sets *pp_store to the page and returns 0.
+// Returns -E_INVAL if srcva is not page-aligned, perm is inappropriate
+// (see sys_page_alloc), srcva is not mapped in src's address space,
+// or (perm & PTE_W) but srcva is read-only in src's address space.
+static int
+ipc_check_page(struct Env *src, void *srcva, unsigned perm,
+	       struct PageInfo **pp_store)
+{
+	pte_t *pagetableentry;
+	struct PageInfo *tpage;
+
+	if ((uintptr_t)srcva%PGSIZE!=0)
+		return -E_INVAL;
+	//此处不能直接使用sys_page_map,因为sys_page_map会检查对应权限
+	//从而出错
+	if ((perm&(PTE_P|PTE_U))!=(PTE_P|PTE_U))//检查标志位
+		return -E_INVAL;
+	if ((perm&(~PTE_P)&(~PTE_U)&(~PTE_AVAIL)&(~PTE_W))!=0)
+		return -E_INVAL;
+	tpage=page_lookup(src->env_pgdir,srcva,&pagetableentry);
+	//使用page_lookup在发送方environment中查找srcva对应的页
+	if (!tpage)  //如果srcva不在发送方的地址空间中
+		return -E_INVAL;//返回-E_INVAL
+	if (((*pagetableentry&PTE_W)==0)&&(perm&PTE_W))//如果试图将只读页作为可写页发送
+		return -E_INVAL;                       //返回-E_INVAL
+	*pp_store=tpage;
+	return 0;
+}
+
+// Return the kernel address of e's IPC buffer at UIPCBUF, or NULL if
+// e has not mapped one.
+static struct IpcBuf *
+ipc_buf(struct Env *e)
+{
+	struct PageInfo *pp;
+	pte_t *pte;
+
+	pp=page_lookup(e->env_pgdir,UIPCBUF,&pte);
+	if (!pp||!(*pte&PTE_U))
+		return NULL;
+	return page2kva(pp);
+}
+
+// Record the size of the current environment's receive window at
+// 'dstva' from its IPC buffer.
+// Returns -E_INVAL if the window does not fit below UTOP.
+static int
+ipc_set_window(void *dstva)
+{
+	struct IpcBuf *ib;
+	uint32_t n=1;
+
+	if ((ib=ipc_buf(curenv))&&ib->ib_rcvnpages>1)
+		n=MIN(ib->ib_rcvnpages,IPC_MAXPAGES);
+	if ((uintptr_t)dstva<UTOP&&(uintptr_t)dstva+n*PGSIZE>UTOP)
+		return -E_INVAL;
+	curenv->env_ipc_dstnpages=n;
+	return 0;
+}
+
+// Copy the message registers 'src' has put in its IPC buffer at UIPCBUF
+// into dst->env_ipc_mr.  An environment without an IPC buffer sends none.
+static void
+ipc_copy_mr(struct Env *dst, struct Env *src)
+{
+	struct IpcBuf *ib;
+	uint32_t n;
+
+	dst->env_ipc_nmr=0;
+	if (!(ib=ipc_buf(src)))
+		return;
+	n=MIN(ib->ib_nmr,IPC_NMR);  //只读取一次,发送方可能在其他CPU上修改
+	memcpy(dst->env_ipc_mr,ib->ib_mr,n*sizeof(uint32_t));
+	dst->env_ipc_nmr=n;
+}
+
+// Deliver 'value' (and the pages at 'srcva' in src's address space, if
+// srcva < UTOP), along with src's message registers, from 'src' to
+// 'dst', which must be blocked in sys_ipc_recv.  Updates dst's ipc
+// fields as described for sys_ipc_try_send, but leaves dst's status
+// alone: the caller is responsible for waking dst up.
+//
+// Returns 0 on success, < 0 on error (see sys_ipc_try_send).
+static int
+ipc_deliver(struct Env *dst, struct Env *src, uint32_t value,
+	    void *srcva, unsigned perm)
+{
+	struct PageInfo *pages[IPC_MAXPAGES];
+	struct IpcBuf *ib;
+	uint32_t i, n;
+	int t;
+
+	dst->env_ipc_perm=0;
+	dst->env_ipc_npages=0;
+	if ((uintptr_t)srcva<UTOP) //如果srcva<UTOP,表示发送方试图发送页
+	{
+		if ((uintptr_t)srcva%PGSIZE!=0)
+			return -E_INVAL;
+		n=1;
+		if ((ib=ipc_buf(src))&&ib->ib_npages>1)
+			n=ib->ib_npages;
+		if (n>IPC_MAXPAGES||(uintptr_t)srcva+n*PGSIZE>UTOP)
+			return -E_INVAL;
+		if ((uintptr_t)dst->env_ipc_dstva<UTOP)
+		//如果目标environment的dstva<UTOP,表明需要接收页
+		{
+			if (n>dst->env_ipc_dstnpages) //接收窗口放不下
+				return -E_INVAL;
+			//先检查所有页并建立页表,保证要么全部映射,要么都不映射
+			for (i=0;i<n;i++)
+			{
+				if ((t=ipc_check_page(src,srcva+i*PGSIZE,perm,&pages[i]))<0)
+					return t;
+				env_pde_note(dst,dst->env_ipc_dstva+i*PGSIZE);
+				if (!pgdir_walk(dst->env_pgdir,dst->env_ipc_dstva+i*PGSIZE,1))
+					return -E_NO_MEM;
+			}
+			for (i=0;i<n;i++)
+			//页表已存在,page_insert不会失败
+				if ((t=page_insert(dst->env_pgdir,pages[i],
+						   dst->env_ipc_dstva+i*PGSIZE,perm))<0)
+					return t;
+			dst->env_ipc_perm=perm; //设置ipc_perm标志位
+			dst->env_ipc_npages=n;
+		}
+	}
+	ipc_copy_mr(dst,src);
+	dst->env_ipc_recving=0;
+	//目标environment已接收到信息,所以将其ipc_recving设为0,表示不再继续接收
+	dst->env_ipc_from=src->env_id;
+	//ipc_from设为发送方environment
+	dst->env_ipc_value=value;
+	//对应接收的值
+	return 0;
+}
+
 // Try to send 'value' to the target env 'envid'.
 // If srcva < UTOP, then also send page currently mapped at 'srcva',
 // so that receiver gets a duplicate mapping of the same page.
+// If the sender's IPC buffer asks for ib_npages > 1, the whole range of
+// that many pages starting at srcva is sent and mapped contiguously at
+// the receiver's dstva, which must have room for all of them (its
+// ib_rcvnpages when it started receiving); either every page is mapped
+// or none is.
 //
 // The send fails with a return value of -E_IPC_NOT_RECV if the
 // target is not blocked, waiting for an IPC.
@@ -314,7 +482,9 @@ sys_page_unmap(envid_t envid, void *va)
 //    env_ipc_recving is set to 0 to block future sends;
 //    env_ipc_from is set to the sending envid;
 //    env_ipc_value is set to the 'value' parameter;
-//    env_ipc_perm is set to 'perm' if a page was transferred, 0 otherwise.
+//    env_ipc_perm is set to 'perm' if a page was transferred, 0 otherwise;
+//    env_ipc_npages is set to the number of pages transferred;
+//    env_ipc_nmr and env_ipc_mr are set from the sender's IPC buffer.
 // The target environment is marked runnable again, returning 0
 // from the paused sys_ipc_recv system call.  (Hint: does the
 // sys_ipc_recv function ever actually return?)
@@ -330,6 +500,8 @@ sys_page_unmap(envid_t envid, void *va)
 //	-E_IPC_NOT_RECV if envid is not currently blocked in sys_ipc_recv,
 //		or another environment managed to send first.
 //	-E_INVAL if srcva < UTOP but srcva is not page-aligned.
+//	-E_INVAL if more pages are sent than IPC_MAXPAGES, or than fit in
+//		the receiver's window.
 //	-E_INVAL if srcva < UTOP and perm is inappropriate
 //		(see sys_page_alloc).
 //	-E_INVAL if srcva < UTOP but srcva is not mapped in the caller's
@@ -348,41 +520,8 @@ sys_ipc_try_send(envid_t envid, uint32_t value, void *srcva, unsigned perm)
 		return -E_BAD_ENV;
 	if (e->env_ipc_recving==0)   //如果对应的environment没有在接受信息
 		return  -E_IPC_NOT_RECV; //返回-E_PIC_NOT_RECV
-	if ((uintptr_t)srcva<UTOP) //如果srcva<UTOP,表示该environment试图发送一个页
-	{
-		if ((uintptr_t )srcva%PGSIZE!=0)
-			return -E_INVAL;
-		if ((uintptr_t)e->env_ipc_dstva<UTOP) 
-		//如果目标environment的dstva<UTOP,表明需要发送一个页
-		{
-			
-			//此处不能直接使用sys_page_map,因为sys_page_map会检查对应权限
-			//从而出错
-			if ((perm&(PTE_P|PTE_U))!=(PTE_P|PTE_U))//检查标志位
-				return -E_INVAL;
-			if ((perm&(~PTE_P)&(~PTE_U)&(~PTE_AVAIL)&(~PTE_W))!=0)
-				return -E_INVAL;
-
-			pte_t *pagetableentry;
-			struct PageInfo *tpage=page_lookup(curenv->env_pgdir,srcva,&pagetableentry);
-			//使用page_lookup在当前environment查找srcva对应的页
-			if (!tpage)  //如果当前srcva不在该environment的地址空间中
-				return -E_INVAL;//返回-E_INVAL
-			if (((*pagetableentry&PTE_W)==0)&&(perm&PTE_W))//如果试图将只读页作为可写页发送
-				return -E_INVAL;                       //返回-E_INVAL
-			t=page_insert(e->env_pgdir,tpage,e->env_ipc_dstva,perm);
-			//将该页插入目的environment的地址空间中
-			if (t)
-				return t;
-			e->env_ipc_perm=perm; //设置ipc_perm标志位
-		}
-	}
-	e->env_ipc_recving=0;  
-	//目标environment已接收到信息,所以将其ipc_recving设为0,表示不再继续接收
-	e->env_ipc_from=curenv->env_id;
-	//ipc_from设为当前environment
-	e->env_ipc_value=value;
-	//对应接收的值
+	if ((t=ipc_deliver(e,curenv,value,srcva,perm))<0)
+		return t;
 	e->env_tf.tf_regs.reg_eax=0;
 	//将目的environment的regs_eax设为0,从而让目的environment的sys_ipc_recv"返回"0
 	e->env_status=ENV_RUNNABLE;
@@ -390,6 +529,112 @@ sys_ipc_try_send(envid_t envid, uint32_t value, void *srcva, unsigned perm)
 	return 0;
 }
 
+// Append 'src' to the send queue of 'dst', recording the message it
+// wants to send.  The caller marks src not runnable.
+static void
+ipc_enqueue(struct Env *dst, struct Env *src, uint32_t value,
+	    void *srcva, unsigned perm)
+{
+	src->env_ipc_sendto=dst;
+	src->env_ipc_send_value=value;
+	src->env_ipc_send_srcva=srcva;
+	src->env_ipc_send_perm=perm;
+	src->env_ipc_sendq_link=NULL;
+	if (dst->env_ipc_sendq_tail)
+		dst->env_ipc_sendq_tail->env_ipc_sendq_link=src;
+	else
+		dst->env_ipc_sendq=src;
+	dst->env_ipc_sendq_tail=src;
+}
+
+// 'r' has just started receiving.  Take senders off r's send queue in
+// FIFO order until one of them is delivered successfully.  Senders whose
+// transfer fails are made runnable with the error.  A successful sender
+// that is blocked in sys_ipc_call or sys_ipc_reply_recv starts receiving
+// in turn instead of becoming runnable.  If nobody is queued, a
+// pending NOTIFY_RECV notification is delivered instead (see
+// env_recv_notify).
+//
+// Returns 1 if r received a message, 0 if r is still receiving.
+static int
+ipc_recv_queued(struct Env *r)
+{
+	struct Env *s;
+	int t;
+
+	while ((s=r->env_ipc_sendq)!=NULL)
+	{
+		r->env_ipc_sendq=s->env_ipc_sendq_link;
+		if (!r->env_ipc_sendq)
+			r->env_ipc_sendq_tail=NULL;
+		s->env_ipc_sendq_link=NULL;
+		s->env_ipc_sendto=NULL;
+		t=ipc_deliver(r,s,s->env_ipc_send_value,
+			      s->env_ipc_send_srcva,s->env_ipc_send_perm);
+		if (t==0&&s->env_ipc_calling)
+		//发送方在call中:发送完成后转为接收,等待回复
+		{
+			s->env_ipc_calling=0;
+			s->env_ipc_recving=1;
+			s->env_ipc_dstva=s->env_ipc_call_dstva;
+			if (ipc_recv_queued(s))
+			{
+				s->env_tf.tf_regs.reg_eax=0;
+				s->env_status=ENV_RUNNABLE;
+			}
+			return 1;
+		}
+		s->env_ipc_calling=0;
+		s->env_tf.tf_regs.reg_eax=t;  //发送方的sys_ipc_send"返回"t
+		s->env_status=ENV_RUNNABLE;
+		if (t==0)
+			return 1;
+	}
+	return env_recv_notify(r);
+}
+
+// Send 'value' (and the page at 'srcva' with 'perm', if srcva < UTOP)
+// to the target env 'envid', blocking until the target receives it.
+//
+// If the target is already blocked in sys_ipc_recv, the message is
+// delivered right away, exactly as sys_ipc_try_send would.  Otherwise
+// the caller is appended to the target's send queue (env_ipc_sendq),
+// marked not runnable, and gives up the CPU.  When the target next calls
+// sys_ipc_recv it takes the first queued sender, completes the transfer
+// (including the page mapping) and makes that sender runnable again,
+// returning the result of the transfer from its sys_ipc_send.
+// Senders are served in FIFO order.
+//
+// Returns 0 on success, < 0 on error.  Errors are:
+//	-E_BAD_ENV if environment envid doesn't currently exist,
+//		or it was destroyed while we were queued on it.
+//	-E_INVAL if envid is the calling environment.
+//	-E_INVAL, -E_NO_MEM as for sys_ipc_try_send.  Page arguments are
+//		checked before blocking, and checked again on delivery.
+static int
+sys_ipc_send(envid_t envid, uint32_t value, void *srcva, unsigned perm)
+{
+	struct Env *e;
+	struct PageInfo *tpage;
+	int t;
+
+	if (envid2env(envid,&e,0)<0)
+		return -E_BAD_ENV;
+	if (e==curenv)       //向自己发送将永远阻塞
+		return -E_INVAL;
+	if ((uintptr_t)srcva<UTOP&&(t=ipc_check_page(curenv,srcva,perm,&tpage))<0)
+		return t;
+	if (e->env_ipc_recving)   //目标正在接收,直接发送
+		return sys_ipc_try_send(envid,value,srcva,perm);
+
+	//否则将当前environment加入目标的发送队列尾部,并阻塞
+	curenv->env_ipc_calling=0;
+	ipc_enqueue(e,curenv,value,srcva,perm);
+	curenv->env_status=ENV_NOT_RUNNABLE;
+	sched_yield();
+	return 0;
+}
+
 // Block until a value is ready.  Record that you want to receive
 // using the env_ipc_recving and env_ipc_dstva fields of struct Env,
 // mark yourself not runnable, and then give up the CPU.
@@ -397,10 +642,18 @@ sys_ipc_try_send(envid_t envid, uint32_t value, void *srcva, unsigned perm)
 // If 'dstva' is < UTOP, then you are willing to receive a page of data.
 // 'dstva' is the virtual address at which the sent page should be mapped.
 //
+// If some environment is already blocked in sys_ipc_send to us, take
+// the first one off our send queue, complete its transfer and return 0
+// without blocking.
+//
+// A NOTIFY_RECV notification (see sys_notify) posted to us while we
+// wait, or before, ends the wait as an empty message from envid 0.
+//
 // This function only returns on error, but the system call will eventually
 // return 0 on success.
 // Return < 0 on error.  Errors are:
-//	-E_INVAL if dstva < UTOP but dstva is not page-aligned.
+//	-E_INVAL if dstva < UTOP but dstva is not page-aligned, or the
+//		receive window in our IPC buffer does not fit below UTOP.
 static int
 sys_ipc_recv(void *dstva)
 {
@@ -408,13 +661,352 @@ sys_ipc_recv(void *dstva)
 	if (((uintptr_t)dstva<UTOP)&&((uintptr_t)dstva%PGSIZE!=0)) 
 	//检查dstva
 		return -E_INVAL;
+	if (ipc_set_window(dstva)<0)
+		return -E_INVAL;
 	curenv->env_ipc_recving=1;//将ipc_recving设为1,表明在接收
 	curenv->env_ipc_dstva=dstva;
+	curenv->env_ipc_notify=1;
+	if (ipc_recv_queued(curenv))
+	//如果发送队列中有阻塞的发送方,按FIFO顺序直接完成传送
+		return 0;
 	curenv->env_status=ENV_NOT_RUNNABLE;//将当前environment状态设为不可运行
 	sched_yield();	 //使用sched_yield让cpu运行其他可运行的environment
 	return 0;
 }
 
+// Send a message to 'envid' and then receive one, as if by
+// sys_ipc_send(envid, value, srcva, perm) followed by sys_ipc_recv(dstva),
+// but in a single kernel entry.  The caller starts receiving the moment
+// its message is delivered, so a reply can never find it not receiving.
+//
+// If the target is already receiving, the message is delivered and,
+// unless someone is already queued to send to us, we switch straight
+// to the target without going through the scheduler.  Otherwise we
+// wait on the target's send queue as in sys_ipc_send.
+//
+// If 'notify' is set, NOTIFY_RECV ends the receive as it does for
+// sys_ipc_recv.  Callers waiting for a reply pass 0.
+//
+// On success the system call returns 0 once a message has been
+// received, with the usual env_ipc_* fields set.  Errors are those of
+// sys_ipc_send, and -E_INVAL if dstva < UTOP but is not page-aligned;
+// in either case nothing has been received.
+static int
+ipc_send_recv(envid_t envid, uint32_t value, void *srcva, unsigned perm,
+	      void *dstva, bool notify)
+{
+	struct Env *e;
+	struct PageInfo *tpage;
+	int t;
+
+	if (((uintptr_t)dstva<UTOP)&&((uintptr_t)dstva%PGSIZE!=0))
+		return -E_INVAL;
+	if (ipc_set_window(dstva)<0)
+		return -E_INVAL;
+	if (envid2env(envid,&e,0)<0)
+		return -E_BAD_ENV;
+	if (e==curenv)
+		return -E_INVAL;
+	if ((uintptr_t)srcva<UTOP&&(t=ipc_check_page(curenv,srcva,perm,&tpage))<0)
+		return t;
+	curenv->env_ipc_notify=notify;
+	if (!e->env_ipc_recving)
+	//目标未在接收:排队等待发送,送达后由接收方将我们转为接收状态
+	{
+		curenv->env_ipc_calling=1;
+		curenv->env_ipc_call_dstva=dstva;
+		ipc_enqueue(e,curenv,value,srcva,perm);
+		curenv->env_status=ENV_NOT_RUNNABLE;
+		sched_yield();
+	}
+	if ((t=ipc_deliver(e,curenv,value,srcva,perm))<0)
+		return t;
+	e->env_tf.tf_regs.reg_eax=0;
+	curenv->env_ipc_recving=1;
+	curenv->env_ipc_dstva=dstva;
+	if (ipc_recv_queued(curenv))
+	{
+		e->env_status=ENV_RUNNABLE;
+		return 0;
+	}
+	curenv->env_status=ENV_NOT_RUNNABLE;
+	env_run(e);	//直接切换到目标environment,不经过调度器
+}
+
+// Client side of a remote procedure call: send a request to 'envid'
+// and wait for the reply.  See ipc_send_recv.
+static int
+sys_ipc_call(envid_t envid, uint32_t value, void *srcva, unsigned perm,
+	     void *dstva)
+{
+	return ipc_send_recv(envid,value,srcva,perm,dstva,0);
+}
+
+// Server side of a remote procedure call: reply to the client 'envid'
+// and wait for the next request.  See ipc_send_recv.
+static int
+sys_ipc_reply_recv(envid_t envid, uint32_t value, void *srcva, unsigned perm,
+		   void *dstva)
+{
+	return ipc_send_recv(envid,value,srcva,perm,dstva,1);
+}
+
+// Post notification 'bits' to environment 'envid'.  Notifications
+// never block and coalesce: each environment has one word of pending
+// bits, and posting a bit that is already pending does nothing more.
+// The target collects them with sys_wait_notify.  A receiver in
+// sys_ipc_recv or sys_ipc_reply_recv is also woken by NOTIFY_RECV.
+//
+// Returns 0 on success, < 0 on error.  Errors are:
+//	-E_BAD_ENV if environment envid doesn't currently exist.
+static int
+sys_notify(envid_t envid, uint32_t bits)
+{
+	struct Env *e;
+
+	if (envid2env(envid,&e,0)<0)
+		return -E_BAD_ENV;
+	env_notify(e,bits);
+	return 0;
+}
+
+// Wait until any notification bit in 'mask' is pending, then clear
+// those pending bits and return them.  Returns at once if some already
+// are.  Bits outside 'mask' stay pending.
+static int
+sys_wait_notify(uint32_t mask)
+{
+	uint32_t got;
+
+	env_notify_collect(curenv);  //先收取之前广播的位
+	if ((got=curenv->env_notify&mask)!=0)
+	{
+		curenv->env_notify&=~got;
+		return got;
+	}
+	env_notify_wait(mask);
+	sched_yield();
+}
+
+// Use the page at 'va' as the current environment's submission/
+// completion ring (struct Ring), or stop using a ring if va >= UTOP.
+// The page must be mapped user-writable and PTE_SHARE, so that fork
+// does not make it copy-on-write and move the environment off the page
+// the kernel drains; the kernel keeps a reference to it, so it stays
+// put even if the environment unmaps it.  The ring starts out empty.
+//
+// Each time the environment traps into the kernel, and whenever a CPU
+// is idle while the environment is blocked, the kernel carries out the
+// system calls it has queued (see ring_drain), posting a completion for
+// each and raising NOTIFY_RING.
+//
+// Returns 0 on success, < 0 on error.  Errors are:
+//	-E_INVAL if va < UTOP but is not page-aligned, or not mapped
+//		user-writable and shared.
+static int
+sys_ring_setup(void *va)
+{
+	struct PageInfo *pp;
+	pte_t *pte;
+
+	if ((uintptr_t)va<UTOP)
+	{
+		if ((uintptr_t)va%PGSIZE!=0)
+			return -E_INVAL;
+		pp=page_lookup(curenv->env_pgdir,va,&pte);
+		if (!pp||(*pte&(PTE_U|PTE_W|PTE_SHARE))!=(PTE_U|PTE_W|PTE_SHARE))
+			return -E_INVAL;
+		pp->pp_ref++;   //内核持有一个引用,环所在的页不会被释放
+	}
+	else
+		pp=NULL;
+	if (curenv->env_ring)
+		page_decref(pa2page(PADDR(curenv->env_ring)));
+	curenv->env_ring=NULL;
+	if (pp)
+	{
+		curenv->env_ring=page2kva(pp);
+		memset(curenv->env_ring,0,sizeof(struct Ring));
+	}
+	return 0;
+}
+
+// Does nothing: entering the kernel is what drains the ring.  Returns
+// the number of completions waiting to be collected.
+static int
+sys_ring_enter(void)
+{
+	struct Ring *rg;
+
+	if (!(rg=curenv->env_ring))
+		return 0;
+	return rg->rg_cqtail-rg->rg_cqhead;
+}
+
+// Is there a submission on e's ring that ring_drain could carry out?
+bool
+ring_pending(struct Env *e)
+{
+	struct Ring *rg=e->env_ring;
+
+	return rg&&rg->rg_sqtail!=rg->rg_sqhead
+		&&rg->rg_cqtail-rg->rg_cqhead<RING_NCQE;
+}
+
+// Carry out the system calls curenv has queued on its ring, in order,
+// while there is room for their completions.  Only calls that neither
+// block nor destroy curenv can be queued; anything else completes with
+// -E_INVAL.  curenv's page directory must be loaded, since arguments
+// are user addresses.  Returns the number carried out.
+int
+ring_drain(void)
+{
+	struct Ring *rg=curenv->env_ring;
+	struct RingSqe sqe;
+	struct RingCqe *cqe;
+	uint32_t head;
+	int n;
+
+	static_assert(sizeof(struct Ring)<=PGSIZE);
+	for (n=0;ring_pending(curenv);n++)
+	{
+		head=rg->rg_sqhead;
+		sqe=rg->rg_sq[head%RING_NSQE];  //先拷贝,用户可能同时改写
+		cqe=&rg->rg_cq[rg->rg_cqtail%RING_NCQE];
+		cqe->cqe_tag=sqe.sqe_tag;
+		switch (sqe.sqe_op)
+		{
+		case SYS_page_alloc:
+		case SYS_page_map:
+		case SYS_page_unmap:
+		case SYS_notify:
+			cqe->cqe_res=syscall(sqe.sqe_op,sqe.sqe_arg[0],sqe.sqe_arg[1],
+					     sqe.sqe_arg[2],sqe.sqe_arg[3],sqe.sqe_arg[4]);
+			break;
+		case SYS_ipc_try_send:  //不能发给自己:可能正在接收的是我们自己
+			if (sqe.sqe_arg[0]==0||sqe.sqe_arg[0]==curenv->env_id)
+				cqe->cqe_res=-E_INVAL;
+			else
+				cqe->cqe_res=syscall(sqe.sqe_op,sqe.sqe_arg[0],sqe.sqe_arg[1],
+						     sqe.sqe_arg[2],sqe.sqe_arg[3],sqe.sqe_arg[4]);
+			break;
+		default:
+			cqe->cqe_res=-E_INVAL;
+		}
+		__sync_synchronize();  //先写完completion,再推进索引
+		rg->rg_sqhead=head+1;
+		rg->rg_cqtail++;
+	}
+	if (n>0)
+		env_notify(curenv,NOTIFY_RING);
+	return n;
+}
+
+// Announce the current environment as an instance of service 'type',
+// so sys_lookup_service can return it.  An environment may serve its
+// own type, and a child of a server may serve its parent's type (it
+// takes on that type), so a server can fork workers to share its load.
+//
+// Returns 0 on success, < 0 on error.  Errors are:
+//	-E_INVAL if type is not a service type, or the caller may not
+//		serve it.
+//	-E_NO_MEM if type already has NSVCINST instances.
+static int
+sys_register_service(int type)
+{
+	struct Env *p;
+	int r;
+
+	if (type<=ENV_TYPE_USER||type>=NENVTYPE)
+		return -E_INVAL;
+	if (curenv->env_type!=type)
+	{
+		if (curenv->env_type!=ENV_TYPE_USER
+		    ||envid2env(curenv->env_parent_id,&p,0)<0
+		    ||p->env_type!=type)
+			return -E_INVAL;
+	}
+	if ((r=svc_register(curenv,type))<0)
+		return r;
+	curenv->env_type=type;
+	return 0;
+}
+
+// Return the envid of an instance of service 'type'.  Successive
+// lookups rotate through the instances.
+//
+// Returns the envid on success, < 0 on error.  Errors are:
+//	-E_INVAL if type is not a service type.
+//	-E_BAD_ENV if no environment serves type.
+static envid_t
+sys_lookup_service(int type)
+{
+	envid_t id;
+
+	if (type<=ENV_TYPE_USER||type>=NENVTYPE)
+		return -E_INVAL;
+	if ((id=svc_lookup(type))==0)
+		return -E_BAD_ENV;
+	return id;
+}
+
+// Find the physical address of the user-readable word at 'addr' in
+// curenv, and its kernel address in *kva_store.  The word may be above
+// UTOP: an environment may wait on its child's env_id in envs[].
+// Returns the physical address, or < 0 on error:
+//	-E_INVAL if addr is not 4-byte aligned.
+//	-E_FAULT if addr is not mapped user-accessible.
+static physaddr_t
+futex_addr(const void *addr, uint32_t **kva_store)
+{
+	struct PageInfo *pp;
+	pte_t *pte;
+
+	if ((uintptr_t)addr%4!=0)
+		return -E_INVAL;
+	if (!(pp=page_lookup(curenv->env_pgdir,(void *)addr,&pte))||!(*pte&PTE_U))
+		return -E_FAULT;
+	*kva_store=(uint32_t *)((char *)page2kva(pp)+PGOFF(addr));
+	return page2pa(pp)+PGOFF(addr);
+}
+
+// If the word at 'addr' still holds 'val', block until sys_futex_wake
+// is called on it.  The word is identified by its physical address, so
+// environments that share the page (sfork, PTE_SHARE) can sleep and
+// wake each other on it whatever address each has it at.  The kernel
+// wakes waiters on an env's env_id in envs[] when the env is freed.
+// Returns 0 when woken or if the word did not hold val (callers recheck
+// their condition either way), < 0 on error (see futex_addr).
+static int
+sys_futex_wait(const void *addr, uint32_t val)
+{
+	uint32_t *kva;
+	physaddr_t pa;
+
+	if ((int32_t)(pa=futex_addr(addr,&kva))<0)
+		return pa;
+	if (*kva!=val)
+		return 0;
+	futex_enqueue(curenv,pa);
+	curenv->env_tf.tf_regs.reg_eax=0;
+	curenv->env_status=ENV_NOT_RUNNABLE;
+	sched_yield();
+}
+
+// Wake up to 'n' environments blocked in sys_futex_wait on the word at
+// 'addr', oldest first.
+// Returns the number woken, < 0 on error (see futex_addr).
+static int
+sys_futex_wake(const void *addr, int n)
+{
+	uint32_t *kva;
+	physaddr_t pa;
+
+	if ((int32_t)(pa=futex_addr(addr,&kva))<0)
+		return pa;
+	return futex_wake(pa,n);
+}
+
 // Dispatches to the correct kernel function, passing the arguments.
 int32_t
 syscall(uint32_t syscallno, uint32_t a1, uint32_t a2, uint32_t a3, uint32_t a4, uint32_t a5)
@@ -467,9 +1059,42 @@ syscall(uint32_t syscallno, uint32_t a1, uint32_t a2, uint32_t a3, uint32_t a4,
 	case SYS_ipc_try_send:
 		ret=sys_ipc_try_send(a1,a2,(void *)a3,a4);
 		break;
+	case SYS_ipc_send:
+		ret=sys_ipc_send(a1,a2,(void *)a3,a4);
+		break;
+	case SYS_ipc_call:
+		ret=sys_ipc_call(a1,a2,(void *)a3,a4,(void *)a5);
+		break;
+	case SYS_ipc_reply_recv:
+		ret=sys_ipc_reply_recv(a1,a2,(void *)a3,a4,(void *)a5);
+		break;
+	case SYS_notify:
+		ret=sys_notify(a1,a2);
+		break;
+	case SYS_wait_notify:
+		ret=sys_wait_notify(a1);
+		break;
+	case SYS_register_service:
+		ret=sys_register_service(a1);
+		break;
+	case SYS_lookup_service:
+		ret=sys_lookup_service(a1);
+		break;
+	case SYS_futex_wait:
+		ret=sys_futex_wait((const void *)a1,a2);
+		break;
+	case SYS_futex_wake:
+		ret=sys_futex_wake((const void *)a1,a2);
+		break;
 	case SYS_env_set_trapframe:
 		ret=sys_env_set_trapframe(a1,(void *)a2);
 		break;
+	case SYS_ring_setup:
+		ret=sys_ring_setup((void *)a1);
+		break;
+	case SYS_ring_enter:
+		ret=sys_ring_enter();
+		break;
 	default: 
 		return -E_INVAL; //如果没有匹配的系统调用号,返回-E_INVAL
 	}
@@ -8,4 +8,8 @@
 
 int32_t syscall(uint32_t num, uint32_t a1, uint32_t a2, uint32_t a3, uint32_t a4, uint32_t a5);
 
+struct Env;
+bool	ring_pending(struct Env *e);
+int	ring_drain(void);
+
 #endif /* !JOS_KERN_SYSCALL_H */
@@ -22,6 +22,13 @@ static struct Taskstate ts;
  */
 static struct Trapframe *last_tf;
 
+/* Timer interrupts on the boot CPU between the NOTIFY_TIMER ticks sent to
+ * the file system server, which writes back dirty blocks on them: about
+ * a second apart.
+ */
+#define FS_TICKS	100
+static uint32_t timer_ticks;
+
 /* Interrupt descriptor table.  (Must be built at run time because
  * shifted function addresses can't be represented in relocation records.)
  */
@@ -207,6 +214,11 @@ trap_init_percpu(void)
 	gdt[(GD_TSS0>>3)+i].sd_s=0;
 	ltr(GD_TSS0+i*8);	
 	lidt(&idt_pd);
+
+	// Enable FXSAVE/SSE; FPU instructions trap (T_DEVICE) while CR0_TS
+	// is set, for lazy FPU switching (see env_fpu_trap)
+	lcr4(rcr4()|CR4_OSFXSR|CR4_OSXMMEXCPT);
+	lcr0((rcr0()|CR0_MP|CR0_NE|CR0_TS)&~CR0_EM);
 	// Initialize the TSS slot of the gdt.
 				//	sizeof(struct Taskstate) - 1, 0);
 	
@@ -290,17 +302,31 @@ trap_dispatch(struct Trapframe *tf)
 	if (tf->tf_trapno==IRQ_OFFSET+IRQ_TIMER)  //如果是时钟中断
 	{
 		lapic_eoi();
+		if (cpunum()==0&&++timer_ticks%FS_TICKS==0) //只在boot CPU上计数
+			svc_notify(ENV_TYPE_FS,NOTIFY_TIMER);
 		sched_yield(); //使用sched_yield寻找其他可运行的environment运行
 		return ;
 	}
+	else if (tf->tf_trapno==T_DEVICE&&(tf->tf_cs&3)==3)  //用户第一次使用FPU,加载其FPU状态
+	{
+		env_fpu_trap();
+		return;
+	}
 	else if (tf->tf_trapno==IRQ_OFFSET+IRQ_KBD)
 	{
 		kbd_intr();
+		env_notify_all(NOTIFY_CONS);  //唤醒等待控制台输入的进程
 		return;
 	}
 	else if (tf->tf_trapno==IRQ_OFFSET+IRQ_SERIAL)
 	{
 		serial_intr();
+		env_notify_all(NOTIFY_CONS);
+		return;
+	}
+	else if (tf->tf_trapno==IRQ_OFFSET+IRQ_IDE)  //磁盘中断:通知文件系统服务去推进它的读操作
+	{
+		svc_notify(ENV_TYPE_FS,NOTIFY_DISK);
 		return;
 	}
 	else if (tf->tf_trapno==T_PGFLT)  //如果是page fault,分配给对应的page_fault_handler函数进行处理
@@ -375,6 +401,11 @@ trap(struct Trapframe *tf)
 		curenv->env_tf = *tf;
 		// The trapframe on the stack should be ignored from here on.
 		tf = &curenv->env_tf;
+
+		// Carry out whatever the environment queued on its ring
+		// (see sys_ring_setup) since it last entered the kernel.
+		if (curenv->env_ring)
+			ring_drain();
 	}
 
 	// Record that tf is the last real trapframe so
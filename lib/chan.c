@@ -0,0 +1,92 @@
+// Shared-memory channels: a pair of single-producer, single-consumer
+// rings on a page both environments map, so that a stream of messages
+// costs no system calls except when the consumer has to be woken.
+//
+// A consumer that finds its ring empty sleeps in sys_wait_notify.  A
+// producer notifies its peer (NOTIFY_CHAN, the channel "doorbell") only
+// when it makes the ring go from empty to non-empty, and a consumer
+// notifies its peer only when it makes a full ring non-full.
+// Notifications stay pending until the peer looks, so one that races
+// with the peer going to sleep is never lost.
+
+#include <inc/lib.h>
+
+// Full memory barrier: orders our last ring index store before the
+// load of the peer's index that decides whether to notify it.
+#define mb()	__sync_synchronize()
+
+// Set up 'ch' over the shared page at 'va', talking to 'peer'.
+// The environment that allocated the page passes creator = 1, which
+// also empties the rings; the other end passes creator = 0.
+void
+chan_init(struct Chan *ch, void *va, envid_t peer, bool creator)
+{
+	struct Chanring *rings = va;
+
+	static_assert(2 * sizeof(struct Chanring) <= PGSIZE);
+	static_assert((CHAN_NSLOTS & (CHAN_NSLOTS - 1)) == 0);
+
+	ch->ch_peer = peer;
+	ch->ch_tx = &rings[creator ? 0 : 1];
+	ch->ch_rx = &rings[creator ? 1 : 0];
+	if (creator)
+		memset(va, 0, 2 * sizeof(struct Chanring));
+}
+
+// Returns true if chan_send would not have to wait.
+bool
+chan_can_send(struct Chan *ch)
+{
+	return ch->ch_tx->cr_head - ch->ch_tx->cr_tail < CHAN_NSLOTS;
+}
+
+// Append 'm' to our outgoing ring, waiting while it is full.
+// Returns 0 on success, < 0 if the peer is gone.
+int
+chan_send(struct Chan *ch, const struct Chanmsg *m)
+{
+	struct Chanring *r = ch->ch_tx;
+	uint32_t head = r->cr_head;
+	int err;
+
+	while (head - r->cr_tail == CHAN_NSLOTS)
+		sys_wait_notify(NOTIFY_CHAN);
+	r->cr_slot[head % CHAN_NSLOTS] = *m;
+	mb();
+	r->cr_head = head + 1;
+	mb();
+	if (r->cr_tail == head
+	    && (err = sys_notify(ch->ch_peer, NOTIFY_CHAN)) < 0)
+		return err;
+	return 0;
+}
+
+// Take the next message off our incoming ring into 'm', if there is one.
+// Returns true if a message was taken.
+bool
+chan_tryrecv(struct Chan *ch, struct Chanmsg *m)
+{
+	struct Chanring *r = ch->ch_rx;
+	uint32_t tail = r->cr_tail;
+
+	if (r->cr_head == tail)
+		return 0;
+	mb();
+	*m = r->cr_slot[tail % CHAN_NSLOTS];
+	mb();
+	r->cr_tail = tail + 1;
+	mb();
+	if (r->cr_head - tail == CHAN_NSLOTS)
+		sys_notify(ch->ch_peer, NOTIFY_CHAN);
+	return 1;
+}
+
+// Take the next message off our incoming ring into 'm', waiting for
+// one if the ring is empty.  Returns 0.
+int
+chan_recv(struct Chan *ch, struct Chanmsg *m)
+{
+	while (!chan_tryrecv(ch, m))
+		sys_wait_notify(NOTIFY_CHAN);
+	return 0;
+}
@@ -84,7 +84,7 @@ devcons_read(struct Fd *fd, void *vbuf, size_t n)
 		return 0;
 
 	while ((c = sys_cgetc()) == 0)
-		sys_yield();
+		sys_wait_notify(NOTIFY_CONS);
 	if (c < 0)
 		return c;
 	if (c == 0x04)	// ctl-d is eof
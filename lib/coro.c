@@ -0,0 +1,225 @@
+// Coroutines: cooperative threads of control inside one environment.
+//
+// A server makes a coroutine per request and calls coro_run from its
+// receive loop; a request that must wait (for the disk, say) sleeps on
+// a CoroQueue, and the loop goes back to receiving while it does.
+// Whatever it is waiting for calls coro_wakeup, and the next coro_run
+// picks it up again.  Coroutines only switch in coro_yield, coro_sleep
+// and coro_exit, so code between those calls needs no locking.
+//
+// Coroutines belong to the environment that made them: threads made
+// with sfork must not share them.
+
+#include <inc/lib.h>
+#include <inc/x86.h>
+
+enum {
+	CORO_FREE = 0,
+	CORO_READY,
+	CORO_RUNNING,
+	CORO_SLEEPING
+};
+
+struct Coro {
+	uintptr_t co_esp;	// Saved stack pointer while switched out
+	int co_state;
+	void (*co_fn)(void *);
+	void *co_arg;
+	struct Coro *co_next;	// Next on the run queue or a CoroQueue
+	bool co_stack;		// Stack pages are mapped
+};
+
+#define CORO_SLOTSIZE	((CORO_STKPAGES + 1) * PGSIZE)
+
+static struct Coro coros[NCORO];
+static struct Coro *coro_cur;		// Running coroutine, NULL if none
+static uintptr_t coro_sched_esp;	// coro_run's context
+static struct CoroQueue coro_runq;
+
+void coro_switch(uintptr_t *save_esp, uintptr_t esp);
+
+static void
+cq_push(struct CoroQueue *q, struct Coro *c)
+{
+	c->co_next = NULL;
+	if (q->cq_tail)
+		q->cq_tail->co_next = c;
+	else
+		q->cq_head = c;
+	q->cq_tail = c;
+}
+
+static struct Coro *
+cq_pop(struct CoroQueue *q)
+{
+	struct Coro *c;
+
+	if ((c = q->cq_head) != NULL) {
+		q->cq_head = c->co_next;
+		if (!q->cq_head)
+			q->cq_tail = NULL;
+		c->co_next = NULL;
+	}
+	return c;
+}
+
+// Stack top of coroutine c.  The page below its stack is left
+// unmapped, so an overflow faults instead of running into the next.
+static uintptr_t
+coro_stacktop(struct Coro *c)
+{
+	return CORO_STACKS + (c - coros + 1) * CORO_SLOTSIZE;
+}
+
+// Where a new coroutine starts: coro_create lays out its stack so that
+// coro_switch returns here.
+static void
+coro_start(void)
+{
+	coro_cur->co_fn(coro_cur->co_arg);
+	coro_exit();
+}
+
+// Switch from the running coroutine back to coro_run.
+static void
+coro_sched(void)
+{
+	coro_switch(&coro_cur->co_esp, coro_sched_esp);
+}
+
+//
+// Make a coroutine that will run fn(arg) the next time coro_run does.
+// It ends when fn returns.
+// Returns 0 on success, < 0 on error.  Errors are:
+//	-E_NO_MEM if NCORO coroutines already exist, or there is no
+//		memory for the stack.
+//
+int
+coro_create(void (*fn)(void *), void *arg)
+{
+	struct Coro *c;
+	uint32_t *sp;
+	int i, r;
+
+	for (c = coros; c < coros + NCORO; c++)
+		if (c->co_state == CORO_FREE)
+			break;
+	if (c == coros + NCORO)
+		return -E_NO_MEM;
+
+	// Stacks are kept when a coroutine exits, for the next one to use.
+	if (!c->co_stack) {
+		for (i = 1; i <= CORO_STKPAGES; i++)
+			if ((r = sys_page_alloc(0, (void *) (coro_stacktop(c) - i * PGSIZE),
+						PTE_P | PTE_U | PTE_W)) < 0)
+				return r;
+		c->co_stack = 1;
+	}
+
+	// What coro_switch pops: edi, esi, ebx, ebp, then the return
+	// address.  Above that, a null return address for coro_start.
+	sp = (uint32_t *) coro_stacktop(c);
+	*--sp = 0;
+	*--sp = (uint32_t) coro_start;
+	for (i = 0; i < 4; i++)
+		*--sp = 0;
+	c->co_esp = (uintptr_t) sp;
+	c->co_fn = fn;
+	c->co_arg = arg;
+	c->co_state = CORO_READY;
+	cq_push(&coro_runq, c);
+	return 0;
+}
+
+//
+// Run coroutines until none is ready to run.  Each runs until it
+// yields, sleeps or exits.  Must not be called from a coroutine.
+//
+void
+coro_run(void)
+{
+	struct Coro *c;
+
+	assert(!coro_cur);
+	while ((c = cq_pop(&coro_runq)) != NULL) {
+		c->co_state = CORO_RUNNING;
+		coro_cur = c;
+		coro_switch(&coro_sched_esp, c->co_esp);
+		coro_cur = NULL;
+	}
+}
+
+//
+// Let the other ready coroutines run before continuing.
+//
+void
+coro_yield(void)
+{
+	assert(coro_cur);
+	coro_cur->co_state = CORO_READY;
+	cq_push(&coro_runq, coro_cur);
+	coro_sched();
+}
+
+//
+// End the running coroutine.
+//
+void
+coro_exit(void)
+{
+	assert(coro_cur);
+	coro_cur->co_state = CORO_FREE;
+	coro_sched();
+	panic("coro_exit: freed coroutine ran");
+}
+
+//
+// Sleep on q until someone calls coro_wakeup(q).  The caller should
+// recheck what it was waiting for when this returns.
+//
+void
+coro_sleep(struct CoroQueue *q)
+{
+	assert(coro_can_sleep());
+	coro_cur->co_state = CORO_SLEEPING;
+	cq_push(q, coro_cur);
+	coro_sched();
+}
+
+//
+// Make every coroutine asleep on q ready to run.  Does not switch, so
+// it can be called from anywhere, coroutine or not.
+//
+void
+coro_wakeup(struct CoroQueue *q)
+{
+	struct Coro *c;
+
+	while ((c = cq_pop(q)) != NULL) {
+		c->co_state = CORO_READY;
+		cq_push(&coro_runq, c);
+	}
+}
+
+//
+// Index of the running coroutine, from 0 to NCORO-1, or -1 if called
+// from outside any coroutine.
+//
+int
+coro_id(void)
+{
+	return coro_cur ? coro_cur - coros : -1;
+}
+
+//
+// Can the caller sleep?  Only a coroutine can, and not from a page
+// fault handler: those run on the one user exception stack, which
+// another coroutine's fault would reuse.
+//
+bool
+coro_can_sleep(void)
+{
+	uintptr_t esp = read_esp();
+
+	return coro_cur && !(esp >= UXSTACKTOP - PGSIZE && esp < UXSTACKTOP);
+}
@@ -5,6 +5,19 @@
 #define debug 0
 
 union Fsipc fsipcbuf __attribute__((aligned(PGSIZE)));
+static envid_t fsenv;
+
+// Window of pages that carry the data for FSREQ_READ and FSREQ_WRITE.
+#define FSWIN		((char *) 0xE0000000)
+
+// Optional shared-memory channel to the file server (see fs_channel).
+// Its pages are PTE_SHARE, so a child created by fork or spawn maps them
+// too; only the environment that opened the channel uses it.
+#define FSCHAN		((char *) 0xE0100000)
+static struct Chan fschan;
+static envid_t fschan_owner;
+
+#define fschan_on()	(fschan_owner && fschan_owner == thisenv->env_id)
 
 // Send an inter-environment request to the file server, and wait for
 // a reply.  The request body should be in fsipcbuf, and parts of the
@@ -15,7 +28,6 @@ union Fsipc fsipcbuf __attribute__((aligned(PGSIZE)));
 static int
 fsipc(unsigned type, void *dstva)
 {
-	static envid_t fsenv;
 	if (fsenv == 0)
 		fsenv = ipc_find_env(ENV_TYPE_FS);
 
@@ -24,8 +36,85 @@ fsipc(unsigned type, void *dstva)
 	if (debug)
 		cprintf("[%08x] fsipc %d %08x\n", thisenv->env_id, type, *(uint32_t *)&fsipcbuf);
 
-	ipc_send(fsenv, type, &fsipcbuf, PTE_P | PTE_W | PTE_U);
-	return ipc_recv(NULL, dstva, NULL);
+	return ipc_call(fsenv, type, &fsipcbuf, PTE_P | PTE_W | PTE_U,
+			dstva, NULL);
+}
+
+// Map the first 'npages' pages of FSWIN writable, allocating any that
+// are missing or copy-on-write (after fork, for instance).
+static int
+fswin_map(size_t npages)
+{
+	size_t i;
+	char *va;
+	int r;
+
+	for (i = 0; i < npages; i++) {
+		va = FSWIN + i * PGSIZE;
+		if ((uvpd[PDX(va)] & PTE_P)
+		    && (uvpt[PGNUM(va)] & (PTE_P | PTE_W)) == (PTE_P | PTE_W))
+			continue;
+		if ((r = sys_page_alloc(0, va, PTE_P | PTE_U | PTE_W)) < 0)
+			return r;
+	}
+	return 0;
+}
+
+// Return where the data of a read or write of 'n' bytes goes, cutting
+// *n down to what fits: the FSWIN pages, or our channel's data window.
+// Returns NULL if FSWIN cannot be mapped.
+static char *
+fsdata_buf(size_t *n)
+{
+	if (fschan_on()) {
+		*n = MIN(*n, FSCHAN_DATAMAX);
+		return FSCHAN + PGSIZE;
+	}
+	*n = MIN(*n, FSDATAMAX);
+	if (fswin_map(MAX(ROUNDUP(*n, PGSIZE) / PGSIZE, 1)) < 0)
+		return NULL;
+	return FSWIN;
+}
+
+// Like fsipc, but for requests small enough to travel in the IPC
+// message registers, so that no page need be sent: the first 'n' bytes
+// of fsipcbuf are the request, and the reply registers are copied back
+// into fsipcbuf.  If 'ndata' is nonzero, the request carries that many
+// bytes of data in the buffer returned by fsdata_buf.
+// Requests go over our channel if we have opened one.
+static int
+fsipc_mr(unsigned type, size_t n, size_t ndata)
+{
+	struct Chanmsg m;
+	size_t npages;
+	int r;
+
+	if (fsenv == 0)
+		fsenv = ipc_find_env(ENV_TYPE_FS);
+
+	if (debug)
+		cprintf("[%08x] fsipc_mr %d %08x\n", thisenv->env_id, type, *(uint32_t *)&fsipcbuf);
+
+	if (fschan_on()) {
+		m.cm_value = type;
+		memmove(m.cm_mr, &fsipcbuf, n);
+		if ((r = chan_send(&fschan, &m)) < 0
+		    || (r = chan_recv(&fschan, &m)) < 0)
+			return r;
+		memmove(&fsipcbuf, m.cm_mr, sizeof(m.cm_mr));
+		return m.cm_value;
+	}
+
+	npages = ndata ? MAX(ROUNDUP(ndata, PGSIZE) / PGSIZE, 1) : 0;
+	ipc_set_mr(&fsipcbuf, n);
+	if (npages) {
+		ipc_set_pages(npages);
+		r = ipc_call(fsenv, type, FSWIN, PTE_P | PTE_U | PTE_W,
+			     NULL, NULL);
+	} else
+		r = ipc_call(fsenv, type, NULL, 0, NULL, NULL);
+	ipc_get_mr(&fsipcbuf, sizeof(fsipcbuf));
+	return r;
 }
 
 static int devfile_flush(struct Fd *fd);
@@ -100,7 +189,7 @@ static int
 devfile_flush(struct Fd *fd)
 {
 	fsipcbuf.flush.req_fileid = fd->fd_file.id;
-	return fsipc(FSREQ_FLUSH, NULL);
+	return fsipc_mr(FSREQ_FLUSH, sizeof(fsipcbuf.flush), 0);
 }
 
 // Read at most 'n' bytes from 'fd' at the current position into 'buf'.
@@ -113,17 +202,19 @@ devfile_read(struct Fd *fd, void *buf, size_t n)
 {
 	// Make an FSREQ_READ request to the file system server after
 	// filling fsipcbuf.read with the request arguments.  The
-	// bytes read will be written back to fsipcbuf by the file
-	// system server.
+	// bytes read will be written by the file system server into
+	// the data buffer that goes along with the request.
+	char *data;
 	int r;
 
+	if (!(data = fsdata_buf(&n)))
+		return -E_NO_MEM;
 	fsipcbuf.read.req_fileid = fd->fd_file.id;
 	fsipcbuf.read.req_n = n;
-	if ((r = fsipc(FSREQ_READ, NULL)) < 0)
+	if ((r = fsipc_mr(FSREQ_READ, sizeof(fsipcbuf.read), MAX(n, 1))) < 0)
 		return r;
 	assert(r <= n);
-	assert(r <= PGSIZE);
-	memmove(buf, fsipcbuf.readRet.ret_buf, r);
+	memmove(buf, data, r);
 	return r;
 }
 
@@ -137,20 +228,19 @@ static ssize_t
 devfile_write(struct Fd *fd, const void *buf, size_t n)
 {
 	// Make an FSREQ_WRITE request to the file system server.  Be
-	// careful: fsipcbuf.write.req_buf is only so large, but
+	// careful: the data buffer is only so large, but
 	// remember that write is always allowed to write *fewer*
 	// bytes than requested.
 	// LAB 5: Your code here
 	int r;
+	char *data;
+	if (!(data=fsdata_buf(&n))) //一次最多写数据缓冲区大小的字节数
+		return -E_NO_MEM;
 	fsipcbuf.write.req_fileid=fd->fd_file.id;
-	if (n>PGSIZE-sizeof(int)-sizeof(size_t)) //一次最多写缓冲区大小的字节数
-		fsipcbuf.write.req_n=PGSIZE-sizeof(int)-sizeof(size_t);
-	else 
-		fsipcbuf.write.req_n=n;
-	
-	memmove(fsipcbuf.write.req_buf,buf,fsipcbuf.write.req_n);
-		//将缓冲区中的数据移入fsipcbuf结构体的写缓冲区
-	if ((r=(fsipc(FSREQ_WRITE,NULL)))<0)//发出对应的FSREQ_WRITE请求
+	fsipcbuf.write.req_n=n;
+	memmove(data,buf,n);
+		//将缓冲区中的数据移入数据缓冲区,随请求一起发送
+	if ((r=fsipc_mr(FSREQ_WRITE,sizeof(fsipcbuf.write),MAX(n,1)))<0)//发出对应的FSREQ_WRITE请求
 		return r;
 	return r;	//返回实际写入的字节数
 }
@@ -161,9 +251,9 @@ devfile_stat(struct Fd *fd, struct Stat *st)
 	int r;
 
 	fsipcbuf.stat.req_fileid = fd->fd_file.id;
-	if ((r = fsipc(FSREQ_STAT, NULL)) < 0)
+	if ((r = fsipc_mr(FSREQ_STAT, sizeof(fsipcbuf.stat), 0)) < 0)
 		return r;
-	strcpy(st->st_name, fsipcbuf.statRet.ret_name);
+	strcpy(st->st_name, fd->fd_file.name);
 	st->st_size = fsipcbuf.statRet.ret_size;
 	st->st_isdir = fsipcbuf.statRet.ret_isdir;
 	return 0;
@@ -175,7 +265,7 @@ devfile_trunc(struct Fd *fd, off_t newsize)
 {
 	fsipcbuf.set_size.req_fileid = fd->fd_file.id;
 	fsipcbuf.set_size.req_size = newsize;
-	return fsipc(FSREQ_SET_SIZE, NULL);
+	return fsipc_mr(FSREQ_SET_SIZE, sizeof(fsipcbuf.set_size), 0);
 }
 
 
@@ -186,6 +276,31 @@ sync(void)
 	// Ask the file server to update the disk
 	// by writing any dirty blocks in the buffer cache.
 
-	return fsipc(FSREQ_SYNC, NULL);
+	return fsipc_mr(FSREQ_SYNC, 0, 0);
 }
 
+
+// Open a shared-memory channel to the file server and send all later
+// stat, flush, truncate, sync, read and write requests over it instead
+// of IPC.  Returns 0 on success, < 0 on error.
+int
+fs_channel(void)
+{
+	int i, r;
+
+	if (fschan_on())
+		return 0;
+	if (fsenv == 0)
+		fsenv = ipc_find_env(ENV_TYPE_FS);
+	for (i = 0; i < FSCHAN_NPAGES; i++)
+		if ((r = sys_page_alloc(0, FSCHAN + i * PGSIZE,
+					PTE_P | PTE_U | PTE_W | PTE_SHARE)) < 0)
+			return r;
+	chan_init(&fschan, FSCHAN, fsenv, 1);
+	ipc_set_pages(FSCHAN_NPAGES);
+	if ((r = ipc_call(fsenv, FSREQ_CHANNEL, FSCHAN,
+			  PTE_P | PTE_U | PTE_W | PTE_SHARE, NULL, NULL)) < 0)
+		return r;
+	fschan_owner = thisenv->env_id;
+	return 0;
+}
@@ -153,10 +153,61 @@ fork(void)
 	return envid;	 //返回子environment的envid
 }
 
-// Challenge!
-int
+// Is va part of the stack sfork gives each child a copy of?
+#define sfork_stack(va)	((va) >= USTACKTOP - PTSIZE && (va) < USTACKTOP)
+
+//
+// Shared-memory fork: like fork, but the child shares every page of
+// our address space writable, except the stack (copy-on-write, as in
+// fork) and the per-environment pages at UTCB and UIPCBUF (it gets its
+// own: sys_exofork maps it a UTCB).  Pages either of us maps after this are not shared.
+//
+// Returns: child's envid to the parent, 0 to the child, < 0 on error.
+//
+envid_t
 sfork(void)
 {
-	panic("sfork not implemented");
-	return -E_INVAL;
+	extern void _pgfault_upcall();
+	envid_t envid;
+	uintptr_t va;
+	int r;
+
+	set_pgfault_handler(pgfault);
+	if ((envid = sys_exofork()) < 0)
+		return envid;
+	if (envid == 0) {
+		// Our UTCB page is our own, so this doesn't touch the parent's.
+		thisenv = &envs[ENVX(sys_getenvid())];
+		return 0;
+	}
+
+	for (va = 0; va < USTACKTOP; va += PGSIZE) {
+		if (!(uvpd[PDX(va)] & PTE_P) || !(uvpt[PGNUM(va)] & PTE_P)
+		    || !(uvpt[PGNUM(va)] & PTE_U))
+			continue;
+		if (va == (uintptr_t) UTCB || va == (uintptr_t) UIPCBUF)
+			continue;
+		if (sfork_stack(va)) {
+			duppage(envid, PGNUM(va));
+			continue;
+		}
+		// Take our own copy of a copy-on-write page first, so the
+		// child shares the page we will go on writing.
+		if (uvpt[PGNUM(va)] & PTE_COW)
+			*(volatile uint8_t *) va = *(volatile uint8_t *) va;
+		if ((r = sys_page_map(0, (void *) va, envid, (void *) va,
+				      uvpt[PGNUM(va)] & PTE_SYSCALL)) < 0)
+			goto err;
+	}
+
+	if ((r = sys_page_alloc(envid, (void *) (UXSTACKTOP - PGSIZE),
+				PTE_P | PTE_U | PTE_W)) < 0
+	    || (r = sys_env_set_pgfault_upcall(envid, _pgfault_upcall)) < 0
+	    || (r = sys_env_set_status(envid, ENV_RUNNABLE)) < 0)
+		goto err;
+	return envid;
+
+    err:
+	sys_env_destroy(envid);
+	return r;
 }
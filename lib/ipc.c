@@ -2,6 +2,87 @@
 
 #include <inc/lib.h>
 
+#define ipcbuf	((struct IpcBuf *) UIPCBUF)
+
+static bool
+ipcbuf_mapped(void)
+{
+	return (uvpd[PDX(UIPCBUF)] & PTE_P) && (uvpt[PGNUM(UIPCBUF)] & PTE_P);
+}
+
+// Map the IPC buffer the first time it is needed.
+static void
+ipcbuf_map(void)
+{
+	int r;
+
+	if (!ipcbuf_mapped()
+	    && (r = sys_page_alloc(0, UIPCBUF, PTE_P | PTE_U | PTE_W)) < 0)
+		panic("ipcbuf_map: %e", r);
+}
+
+// Load the message registers to send with this environment's next IPC:
+// 'n' bytes starting at 'mr', rounded up to whole words.
+// Panics if 'n' is more than IPC_NMR words.
+void
+ipc_set_mr(const void *mr, size_t n)
+{
+	if (n > IPC_NMR * sizeof(uint32_t))
+		panic("ipc_set_mr: %d bytes is too many", n);
+	ipcbuf_map();
+	memmove(ipcbuf->ib_mr, mr, n);
+	ipcbuf->ib_nmr = ROUNDUP(n, sizeof(uint32_t)) / sizeof(uint32_t);
+}
+
+// Make this environment's next IPC send 'npages' contiguous pages,
+// starting at the 'pg' it is given, instead of just one.
+// Panics if 'npages' is more than IPC_MAXPAGES.
+void
+ipc_set_pages(size_t npages)
+{
+	if (npages > IPC_MAXPAGES)
+		panic("ipc_set_pages: %d pages is too many", npages);
+	ipcbuf_map();
+	ipcbuf->ib_npages = npages;
+}
+
+// Make this environment's next receive accept up to 'npages' contiguous
+// pages at the 'pg' it is given, instead of just one.  The number
+// actually received is left in thisenv->env_ipc_npages.
+// Panics if 'npages' is more than IPC_MAXPAGES.
+void
+ipc_set_window(size_t npages)
+{
+	if (npages > IPC_MAXPAGES)
+		panic("ipc_set_window: %d pages is too many", npages);
+	ipcbuf_map();
+	ipcbuf->ib_rcvnpages = npages;
+}
+
+// Copy at most 'n' bytes of the message registers received by the last
+// IPC into 'mr'.  Returns the number of bytes copied.
+size_t
+ipc_get_mr(void *mr, size_t n)
+{
+	n = MIN(n, thisenv->env_ipc_nmr * sizeof(uint32_t));
+	memmove(mr, (const void *) thisenv->env_ipc_mr, n);
+	return n;
+}
+
+// Message registers, page counts and windows go with a single IPC
+// only: forget them once it is done.  Avoid writing the buffer when
+// there is nothing to clear, since after fork it is copy-on-write.
+static void
+ipcbuf_clear(void)
+{
+	if (ipcbuf_mapped()
+	    && (ipcbuf->ib_nmr || ipcbuf->ib_npages || ipcbuf->ib_rcvnpages)) {
+		ipcbuf->ib_nmr = 0;
+		ipcbuf->ib_npages = 0;
+		ipcbuf->ib_rcvnpages = 0;
+	}
+}
+
 // Receive a value via IPC and return it.
 // If 'pg' is nonnull, then any page sent by the sender will be mapped at
 //	that address.
@@ -32,6 +113,7 @@ ipc_recv(envid_t *from_env_store, void *pg, int *perm_store)
 		 t=sys_ipc_recv(pg);
 	else 
 		t=sys_ipc_recv((void*)UTOP);//否则传入一个>=UTOP的值,sys_ipc_recv则当作不接收页来处理
+	ipcbuf_clear();
 	if (t)	
 		return t;	
 	if (from_env_store!=NULL) //如果from_env_store不为NULL
@@ -46,46 +128,90 @@ ipc_recv(envid_t *from_env_store, void *pg, int *perm_store)
 }
 
 // Send 'val' (and 'pg' with 'perm', if 'pg' is nonnull) to 'toenv'.
-// This function keeps trying until it succeeds.
-// It should panic() on any error other than -E_IPC_NOT_RECV.
+// This function blocks in the kernel until the receiver accepts the
+// message: if 'toenv' isn't in ipc_recv yet, we are queued (FIFO) on it
+// and don't use any CPU until it gets to us.
+// It should panic() on any error.
 //
 // Hint:
-//   Use sys_yield() to be CPU-friendly.
-//   If 'pg' is null, pass sys_ipc_try_send a value that it will understand
+//   If 'pg' is null, pass sys_ipc_send a value that it will understand
 //   as meaning "no page".  (Zero is not the right value.)
 void
 ipc_send(envid_t to_env, uint32_t val, void *pg, int perm)
 {
 	// LAB 4: Your code here.
 	int t; 
-	while (1)        //不断尝试发送
-	{
-		if (pg!=NULL) //如果pg不为NULL
-			t=sys_ipc_try_send(to_env,val,pg,perm);
-			//传送值val,页pg,标志位perm给目的environment to_env
-		else 
-			t=sys_ipc_try_send(to_env,val,(void *)UTOP,0);
-			//否则仅传送值val
-		if (t==0) //如果t==0,说明传送成功,退出
-			break;
-		if (t!=-E_IPC_NOT_RECV) //假设出错且不为-E_IPC_NOT_RECV,panic
-		{	
-			cprintf("%e\n",t);	
-			panic("not ipc not recv!");
-		}
-		sys_yield(); //使用sys_yield进行CPU调度,运行其他可运行的environment
-	}
+	if (pg!=NULL) //如果pg不为NULL
+		t=sys_ipc_send(to_env,val,pg,perm);
+		//传送值val,页pg,标志位perm给目的environment to_env
+	else 
+		t=sys_ipc_send(to_env,val,(void *)UTOP,0);
+		//否则仅传送值val
+	ipcbuf_clear();
+	if (t<0) //sys_ipc_send会阻塞直到对方接收,因此任何错误都是真正的错误
+		panic("ipc_send: %e",t);
+}
+
+// Send 'val' (and 'pg' with 'perm', if 'pg' is nonnull) to 'to_env' and
+// wait for its reply, in a single system call.  The reply is received
+// exactly as by ipc_recv(NULL, rcv_pg, perm_store); the envid it came from
+// is not reported, since it is normally 'to_env'.
+// It should panic() on any error.
+int32_t
+ipc_call(envid_t to_env, uint32_t val, void *pg, int perm,
+	 void *rcv_pg, int *perm_store)
+{
+	int t;
+
+	if (perm_store)
+		*perm_store=0;
+	t=sys_ipc_call(to_env,val,pg?pg:(void *)UTOP,pg?perm:0,
+		       rcv_pg?rcv_pg:(void *)UTOP);
+	ipcbuf_clear();
+	if (t<0)
+		panic("ipc_call: %e",t);
+	if (perm_store)
+		*perm_store=thisenv->env_ipc_perm;
+	return thisenv->env_ipc_value;
 }
 
-// Find the first environment of the given type.  We'll use this to
-// find special environments.
+// Reply 'val' (and 'pg' with 'perm', if 'pg' is nonnull) to 'to_env' and
+// wait for the next message, in a single system call.  Servers use this
+// in place of ipc_send followed by ipc_recv.  The next message is
+// received as by ipc_recv(from_env_store, rcv_pg, perm_store).
+// It should panic() on any error.
+int32_t
+ipc_reply_recv(envid_t to_env, uint32_t val, void *pg, int perm,
+	       envid_t *from_env_store, void *rcv_pg, int *perm_store)
+{
+	int t;
+
+	if (from_env_store)
+		*from_env_store=0;
+	if (perm_store)
+		*perm_store=0;
+	t=sys_ipc_reply_recv(to_env,val,pg?pg:(void *)UTOP,pg?perm:0,
+			     rcv_pg?rcv_pg:(void *)UTOP);
+	ipcbuf_clear();
+	if (t<0)
+		panic("ipc_reply_recv: %e",t);
+	if (from_env_store)
+		*from_env_store=thisenv->env_ipc_from;
+	if (perm_store)
+		*perm_store=thisenv->env_ipc_perm;
+	return thisenv->env_ipc_value;
+}
+
+// Find an environment serving the given type, from the kernel's service
+// registry.  We'll use this to find special environments; when a type
+// has several, successive calls spread clients across them.
 // Returns 0 if no such environment exists.
 envid_t
 ipc_find_env(enum EnvType type)
 {
-	int i;
-	for (i = 0; i < NENV; i++)
-		if (envs[i].env_type == type)
-			return envs[i].env_id;
-	return 0;
+	envid_t id;
+
+	if ((id = sys_lookup_service(type)) < 0)
+		return 0;
+	return id;
 }
@@ -5,7 +5,6 @@
 
 extern void umain(int argc, char **argv);
 
-const volatile struct Env *thisenv;
 const char *binaryname = "<unknown>";
 
 void
@@ -13,6 +12,10 @@ libmain(int argc, char **argv)
 {
 	// set thisenv to point at our Env structure in envs[].
 	// LAB 3: Your code here.
+	// thisenv lives in our private UTCB page (see inc/lib.h).
+	if ((!(uvpd[PDX(UTCB)] & PTE_P) || !(uvpt[PGNUM(UTCB)] & PTE_P))
+	    && sys_page_alloc(0, (void *) UTCB, PTE_P | PTE_U | PTE_W) < 0)
+		sys_env_destroy(0);
 	thisenv = envs+ENVX(sys_getenvid());
 	//使用系统调用sys_getenvid得到该进程的id,通过宏ENVS转化为在ENVX数组中的索引,从而得到该环境对应的结构体
 	// save the name of the program so that panic() can use it
@@ -22,9 +22,13 @@ struct Dev devpipe =
 struct Pipe {
 	off_t p_rpos;		// read position
 	off_t p_wpos;		// write position
+	envid_t p_rwaiter;	// reader asleep on an empty pipe, or 0
+	envid_t p_wwaiter;	// writer asleep on a full pipe, or 0
 	uint8_t p_buf[PIPEBUFSIZ];	// data buffer
 };
 
+#define mb()	__sync_synchronize()
+
 int
 pipe(int pfd[2])
 {
@@ -88,6 +92,52 @@ _pipeisclosed(struct Fd *fd, struct Pipe *p)
 	}
 }
 
+// Is the environment recorded in a waiter slot still there?  One that
+// exited while asleep leaves its id behind.
+static bool
+pipe_waiter_alive(envid_t id)
+{
+	const volatile struct Env *e = &envs[ENVX(id)];
+
+	return e->env_id == id && e->env_status != ENV_FREE
+		&& e->env_status != ENV_DYING;
+}
+
+// Sleep until the other end may have made progress.  'cond' is the
+// condition we are waiting out ("pipe empty" or "pipe full") and
+// '*waiter' is our slot in the pipe.  We publish ourselves in the slot,
+// then recheck, so the other end either sees us there after moving
+// data or we see the data it moved.  If another environment already
+// sleeps in the slot, we fall back to yielding rather than steal it;
+// a slot left by an environment that has exited is ours to take.
+#define pipe_wait(fd, p, waiter, cond)					\
+	do {								\
+		envid_t w_ = *(waiter);					\
+		if (w_ != 0 && w_ != thisenv->env_id			\
+		    && pipe_waiter_alive(w_)) {				\
+			sys_yield();					\
+			break;						\
+		}							\
+		*(waiter) = thisenv->env_id;				\
+		mb();							\
+		if ((cond) && !_pipeisclosed(fd, p))			\
+			sys_wait_notify(NOTIFY_PIPE);			\
+		*(waiter) = 0;						\
+	} while (0)
+
+// Wake whoever sleeps in '*waiter', if anyone.
+static void
+pipe_wake(volatile envid_t *waiter)
+{
+	envid_t id;
+
+	mb();
+	if ((id = *waiter) != 0) {
+		*waiter = 0;
+		sys_notify(id, NOTIFY_PIPE);
+	}
+}
+
 int
 pipeisclosed(int fdnum)
 {
@@ -123,15 +173,17 @@ devpipe_read(struct Fd *fd, void *vbuf, size_t n)
 			// if all the writers are gone, note eof
 			if (_pipeisclosed(fd, p))
 				return 0;
-			// yield and see what happens
+			// sleep until a writer moves
 			if (debug)
-				cprintf("devpipe_read yield\n");
-			sys_yield();
+				cprintf("devpipe_read wait\n");
+			pipe_wait(fd, p, &p->p_rwaiter,
+				  p->p_rpos == p->p_wpos);
 		}
 		// there's a byte.  take it.
 		// wait to increment rpos until the byte is taken!
 		buf[i] = p->p_buf[p->p_rpos % PIPEBUFSIZ];
 		p->p_rpos++;
+		pipe_wake(&p->p_wwaiter);
 	}
 	return i;
 }
@@ -157,15 +209,17 @@ devpipe_write(struct Fd *fd, const void *vbuf, size_t n)
 			// note eof
 			if (_pipeisclosed(fd, p))
 				return 0;
-			// yield and see what happens
+			// sleep until a reader moves
 			if (debug)
-				cprintf("devpipe_write yield\n");
-			sys_yield();
+				cprintf("devpipe_write wait\n");
+			pipe_wait(fd, p, &p->p_wwaiter,
+				  p->p_wpos >= p->p_rpos + sizeof(p->p_buf));
 		}
 		// there's room for a byte.  store it.
 		// wait to increment wpos until the byte is stored!
 		p->p_buf[p->p_wpos % PIPEBUFSIZ] = buf[i];
 		p->p_wpos++;
+		pipe_wake(&p->p_rwaiter);
 	}
 
 	return i;
@@ -185,7 +239,22 @@ devpipe_stat(struct Fd *fd, struct Stat *stat)
 static int
 devpipe_close(struct Fd *fd)
 {
+	struct Pipe *p = (struct Pipe*) fd2data(fd);
+	envid_t rw, ww;
+	int r;
+
+	// Closing may leave the other end looking at a closed pipe, so
+	// wake anyone asleep on it once our mapping is gone.  A waiter
+	// that registers after we look is covered by the notification
+	// the kernel broadcasts when an environment exits.
 	(void) sys_page_unmap(0, fd);
-	return sys_page_unmap(0, fd2data(fd));
+	rw = p->p_rwaiter;
+	ww = p->p_wwaiter;
+	r = sys_page_unmap(0, p);
+	if (rw && rw != thisenv->env_id)
+		sys_notify(rw, NOTIFY_PIPE);
+	if (ww && ww != thisenv->env_id)
+		sys_notify(ww, NOTIFY_PIPE);
+	return r;
 }
 
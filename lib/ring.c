@@ -0,0 +1,76 @@
+// Submission/completion rings: queue system calls on a page shared
+// with the kernel (see sys_ring_setup) and collect their results, so
+// that many calls cost one trap, or none if the kernel gets to them
+// while we are blocked.
+//
+// The kernel carries out queued calls whenever we enter it; call
+// sys_ring_enter to make it do so now.  It raises NOTIFY_RING when it
+// posts completions.
+
+#include <inc/lib.h>
+
+#define mb()	__sync_synchronize()
+
+// Use the page at 'rg' as our ring, allocating it if need be.  The page
+// is PTE_SHARE, so after a fork we keep writing the page the kernel
+// reads; the child must not use it.
+// Returns 0 on success, < 0 on error.
+int
+ring_setup(struct Ring *rg)
+{
+	int r;
+
+	static_assert(sizeof(struct Ring) <= PGSIZE);
+	static_assert((RING_NSQE & (RING_NSQE - 1)) == 0);
+	static_assert((RING_NCQE & (RING_NCQE - 1)) == 0);
+
+	if (!(uvpd[PDX(rg)] & PTE_P) || !(uvpt[PGNUM(rg)] & PTE_P))
+		if ((r = sys_page_alloc(0, rg, PTE_P|PTE_U|PTE_W|PTE_SHARE)) < 0)
+			return r;
+	return sys_ring_setup(rg);
+}
+
+// Queue system call 'op' with arguments a1 to a5; its completion will
+// carry 'tag'.  If the ring is full, enter the kernel to drain it.
+// Returns 0 on success, -E_NO_MEM if the ring is still full (its
+// completions are waiting to be collected).
+int
+ring_submit(struct Ring *rg, uint32_t tag, uint32_t op,
+	    uint32_t a1, uint32_t a2, uint32_t a3, uint32_t a4, uint32_t a5)
+{
+	uint32_t tail = rg->rg_sqtail;
+	struct RingSqe *sqe;
+
+	if (tail - rg->rg_sqhead == RING_NSQE) {
+		sys_ring_enter();
+		if (tail - rg->rg_sqhead == RING_NSQE)
+			return -E_NO_MEM;
+	}
+	sqe = &rg->rg_sq[tail % RING_NSQE];
+	sqe->sqe_op = op;
+	sqe->sqe_tag = tag;
+	sqe->sqe_arg[0] = a1;
+	sqe->sqe_arg[1] = a2;
+	sqe->sqe_arg[2] = a3;
+	sqe->sqe_arg[3] = a4;
+	sqe->sqe_arg[4] = a5;
+	mb();
+	rg->rg_sqtail = tail + 1;
+	return 0;
+}
+
+// Take the next completion into 'cqe', if there is one.
+// Returns true if a completion was taken.
+bool
+ring_reap(struct Ring *rg, struct RingCqe *cqe)
+{
+	uint32_t head = rg->rg_cqhead;
+
+	if (rg->rg_cqtail == head)
+		return 0;
+	mb();
+	*cqe = rg->rg_cq[head % RING_NCQE];
+	mb();
+	rg->rg_cqhead = head + 1;
+	return 1;
+}
@@ -111,6 +111,72 @@ sys_ipc_try_send(envid_t envid, uint32_t value, void *srcva, int perm)
 	return syscall(SYS_ipc_try_send, 0, envid, value, (uint32_t) srcva, perm, 0);
 }
 
+int
+sys_ipc_send(envid_t envid, uint32_t value, void *srcva, int perm)
+{
+	return syscall(SYS_ipc_send, 1, envid, value, (uint32_t) srcva, perm, 0);
+}
+
+int
+sys_ipc_call(envid_t envid, uint32_t value, void *srcva, int perm, void *dstva)
+{
+	return syscall(SYS_ipc_call, 1, envid, value, (uint32_t) srcva, perm, (uint32_t) dstva);
+}
+
+int
+sys_ipc_reply_recv(envid_t envid, uint32_t value, void *srcva, int perm, void *dstva)
+{
+	return syscall(SYS_ipc_reply_recv, 1, envid, value, (uint32_t) srcva, perm, (uint32_t) dstva);
+}
+
+int
+sys_notify(envid_t envid, uint32_t bits)
+{
+	return syscall(SYS_notify, 0, envid, bits, 0, 0, 0);
+}
+
+int
+sys_wait_notify(uint32_t mask)
+{
+	return syscall(SYS_wait_notify, 0, mask, 0, 0, 0, 0);
+}
+
+int
+sys_register_service(enum EnvType type)
+{
+	return syscall(SYS_register_service, 1, type, 0, 0, 0, 0);
+}
+
+envid_t
+sys_lookup_service(enum EnvType type)
+{
+	return syscall(SYS_lookup_service, 0, type, 0, 0, 0, 0);
+}
+
+int
+sys_futex_wait(volatile uint32_t *addr, uint32_t val)
+{
+	return syscall(SYS_futex_wait, 0, (uint32_t) addr, val, 0, 0, 0);
+}
+
+int
+sys_futex_wake(volatile uint32_t *addr, int n)
+{
+	return syscall(SYS_futex_wake, 0, (uint32_t) addr, n, 0, 0, 0);
+}
+
+int
+sys_ring_setup(struct Ring *rg)
+{
+	return syscall(SYS_ring_setup, 1, (uint32_t) rg, 0, 0, 0, 0);
+}
+
+int
+sys_ring_enter(void)
+{
+	return syscall(SYS_ring_enter, 0, 0, 0, 0, 0, 0);
+}
+
 int
 sys_ipc_recv(void *dstva)
 {
@@ -0,0 +1,155 @@
+// Threads on top of sfork, and mutexes and condition variables on top
+// of sys_futex_wait and sys_futex_wake.
+//
+// A thread is an environment sharing our memory (see sfork), so it can
+// run on another CPU.  Memory mapped after a thread is created is not
+// shared with it: allocate what threads share before creating them.
+
+#include <inc/lib.h>
+
+struct Thread {
+	volatile uint32_t t_used;	// Slot in use
+	volatile envid_t t_tid;		// The thread's envid
+	volatile uint32_t t_done;	// Set when the thread exits
+};
+
+static struct Thread threads[NTHREAD];
+
+static struct Thread *
+thread_lookup(envid_t tid)
+{
+	int i;
+
+	for (i = 0; i < NTHREAD; i++)
+		if (threads[i].t_used && threads[i].t_tid == tid)
+			return &threads[i];
+	return NULL;
+}
+
+//
+// Start a thread running fn(arg).  It exits when fn returns.
+// Returns the thread's id (its envid), < 0 on error:
+//	-E_NO_FREE_ENV if NTHREAD threads already exist.
+//	Errors from sfork.
+//
+envid_t
+thread_create(void (*fn)(void *), void *arg)
+{
+	struct Thread *t;
+	envid_t tid;
+	int i;
+
+	for (i = 0; i < NTHREAD; i++)
+		if (__sync_bool_compare_and_swap(&threads[i].t_used, 0, 1))
+			break;
+	if (i == NTHREAD)
+		return -E_NO_FREE_ENV;
+	t = &threads[i];
+	t->t_done = 0;
+	t->t_tid = 0;
+
+	if ((tid = sfork()) < 0) {
+		t->t_used = 0;
+		return tid;
+	}
+	if (tid == 0) {
+		t->t_tid = thisenv->env_id;
+		fn(arg);
+		thread_exit();
+	}
+	t->t_tid = tid;
+	return tid;
+}
+
+//
+// End the calling thread.
+//
+void
+thread_exit(void)
+{
+	struct Thread *t;
+
+	if ((t = thread_lookup(thisenv->env_id))) {
+		t->t_done = 1;
+		sys_futex_wake(&t->t_done, NTHREAD);
+	}
+	sys_env_destroy(0);
+}
+
+//
+// Wait for thread tid to exit.
+// Returns 0 on success, -E_BAD_ENV if tid is not an unjoined thread.
+//
+int
+thread_join(envid_t tid)
+{
+	struct Thread *t;
+
+	if (!(t = thread_lookup(tid)))
+		return -E_BAD_ENV;
+	while (!t->t_done)
+		sys_futex_wait(&t->t_done, 0);
+	t->t_tid = 0;
+	t->t_used = 0;
+	return 0;
+}
+
+void
+mutex_lock(struct Mutex *m)
+{
+	uint32_t c;
+
+	if ((c = __sync_val_compare_and_swap(&m->mu_state, 0, 1)) == 0)
+		return;
+	// Contended: mark it so, and sleep until we take it from 0.
+	if (c != 2)
+		c = __sync_lock_test_and_set(&m->mu_state, 2);
+	while (c != 0) {
+		sys_futex_wait(&m->mu_state, 2);
+		c = __sync_lock_test_and_set(&m->mu_state, 2);
+	}
+}
+
+int
+mutex_trylock(struct Mutex *m)
+{
+	return __sync_bool_compare_and_swap(&m->mu_state, 0, 1);
+}
+
+void
+mutex_unlock(struct Mutex *m)
+{
+	// Only make the syscall if someone may be asleep.
+	if (__sync_fetch_and_sub(&m->mu_state, 1) != 1) {
+		m->mu_state = 0;
+		sys_futex_wake(&m->mu_state, 1);
+	}
+}
+
+//
+// Unlock m, wait for a signal on c, and lock m again.  Wakeups may be
+// spurious: recheck the condition.
+//
+void
+cond_wait(struct Cond *c, struct Mutex *m)
+{
+	uint32_t seq = c->cv_seq;
+
+	mutex_unlock(m);
+	sys_futex_wait(&c->cv_seq, seq);
+	mutex_lock(m);
+}
+
+void
+cond_signal(struct Cond *c)
+{
+	__sync_fetch_and_add(&c->cv_seq, 1);
+	sys_futex_wake(&c->cv_seq, 1);
+}
+
+void
+cond_broadcast(struct Cond *c)
+{
+	__sync_fetch_and_add(&c->cv_seq, 1);
+	sys_futex_wake(&c->cv_seq, NENV);
+}
@@ -1,6 +1,8 @@
 #include <inc/lib.h>
 
 // Waits until 'envid' exits.
+// The kernel gives a freed environment's slot a new env_id and wakes
+// futex waiters on the old one, so we can sleep on it.
 void
 wait(envid_t envid)
 {
@@ -9,5 +11,5 @@ wait(envid_t envid)
 	assert(envid != 0);
 	e = &envs[ENVX(envid)];
 	while (e->env_id == envid && e->env_status != ENV_FREE)
-		sys_yield();
+		sys_futex_wait((volatile uint32_t *) &e->env_id, envid);
 }
@@ -0,0 +1,57 @@
+// Measure IPC round-trip cost: ipc_send + ipc_recv on each side versus
+// ipc_call on the client and ipc_reply_recv on the server.
+// Only need to start one of these -- splits into two with fork.
+
+#include <inc/lib.h>
+#include <inc/x86.h>
+
+#define NROUNDS 10000
+
+static void
+server(void)
+{
+	envid_t who;
+	uint32_t v;
+	int i;
+
+	for (i = 0; i < NROUNDS; i++) {
+		v = ipc_recv(&who, 0, 0);
+		ipc_send(who, v + 1, 0, 0);
+	}
+
+	v = ipc_recv(&who, 0, 0);
+	while (1)
+		v = ipc_reply_recv(who, v + 1, 0, 0, &who, 0, 0);
+}
+
+void
+umain(int argc, char **argv)
+{
+	envid_t who;
+	uint64_t start, sendrecv, call;
+	uint32_t v;
+	int i;
+
+	if ((who = fork()) == 0)
+		server();
+
+	start = read_tsc();
+	for (i = 0; i < NROUNDS; i++) {
+		ipc_send(who, i, 0, 0);
+		if ((v = ipc_recv(0, 0, 0)) != i + 1)
+			panic("send/recv round %d: got %d", i, v);
+	}
+	sendrecv = read_tsc() - start;
+
+	start = read_tsc();
+	for (i = 0; i < NROUNDS; i++)
+		if ((v = ipc_call(who, i, 0, 0, 0, 0)) != i + 1)
+			panic("call round %d: got %d", i, v);
+	call = read_tsc() - start;
+
+	sys_env_destroy(who);
+	cprintf("ipc send+recv: %u cycles per round trip\n",
+		(uint32_t) (sendrecv / NROUNDS));
+	cprintf("ipc call:      %u cycles per round trip\n",
+		(uint32_t) (call / NROUNDS));
+}
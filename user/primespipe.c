@@ -4,9 +4,10 @@
 // The picture halfway down the page and the text surrounding it
 // explain what's going on here.
 //
-// Since NENVS is 1024, we can print 1022 primes before running out.
-// The remaining two environments are the integer generator at the bottom
-// of main and user/idle.
+// The environment table grows on demand up to NENV (16384) entries, so
+// we can print a prime per environment until those, or memory for them,
+// run out.  Two environments are the integer generator at the bottom of
+// main and user/idle.
 
 #include <inc/lib.h>
 
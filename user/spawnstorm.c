@@ -0,0 +1,41 @@
+// Measure the cost of creating and tearing down environments:
+// bare sys_exofork + sys_env_destroy, and fork + exit + wait.
+
+#include <inc/lib.h>
+#include <inc/x86.h>
+
+#define NBARE	10000
+#define NFORK	500
+
+void
+umain(int argc, char **argv)
+{
+	uint64_t start, bare, forked;
+	envid_t id;
+	int i;
+
+	start = read_tsc();
+	for (i = 0; i < NBARE; i++) {
+		if ((id = sys_exofork()) < 0)
+			panic("sys_exofork: %e", id);
+		if (id == 0)
+			panic("spawnstorm: unstarted child ran");
+		sys_env_destroy(id);
+	}
+	bare = read_tsc() - start;
+
+	start = read_tsc();
+	for (i = 0; i < NFORK; i++) {
+		if ((id = fork()) < 0)
+			panic("fork: %e", id);
+		if (id == 0)
+			exit();
+		wait(id);
+	}
+	forked = read_tsc() - start;
+
+	cprintf("exofork+destroy:  %u cycles per env\n",
+		(uint32_t) (bare / NBARE));
+	cprintf("fork+exit+wait:   %u cycles per env\n",
+		(uint32_t) (forked / NFORK));
+}
@@ -0,0 +1,47 @@
+// Create and reap many environments, more at once than the
+// environment table starts out with, to exercise its growth.
+
+#include <inc/lib.h>
+
+#define TOTAL	100000
+#define BATCH	1500
+
+envid_t kids[BATCH];
+
+void
+umain(int argc, char **argv)
+{
+	int i, n, done;
+	envid_t id;
+
+	for (done = 0; done < TOTAL; done += n) {
+		n = MIN(BATCH, TOTAL - done);
+
+		// Children that never run: they exist only to be reaped.
+		for (i = 0; i < n; i++) {
+			if ((id = sys_exofork()) < 0)
+				panic("sys_exofork after %d: %e", done + i, id);
+			if (id == 0)
+				panic("stressenv: unstarted child ran");
+			if (envs[ENVX(id)].env_id != id
+			    || envs[ENVX(id)].env_status != ENV_NOT_RUNNABLE)
+				panic("envs[] does not show child %08x", id);
+			kids[i] = id;
+		}
+		for (i = 0; i < n; i++)
+			if ((id = sys_env_destroy(kids[i])) < 0)
+				panic("sys_env_destroy %08x: %e", kids[i], id);
+
+		// And one that runs, to reap the ordinary way.
+		if ((id = fork()) < 0)
+			panic("fork: %e", id);
+		if (id == 0)
+			exit();
+		wait(id);
+		n++;
+
+		if ((done + n) / 10000 != done / 10000)
+			cprintf("%d environments\n", done + n);
+	}
+	cprintf("stressenv ok\n");
+}
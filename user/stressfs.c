@@ -0,0 +1,57 @@
+// Create, fill and truncate files over and over, timing each round, to
+// exercise the file system's block allocator.
+
+#include <inc/lib.h>
+#include <inc/x86.h>
+
+#define NROUNDS	8
+#define NFILES	32
+#define FBLOCKS	4
+
+char buf[BLKSIZE];
+
+void
+umain(int argc, char **argv)
+{
+	char path[MAXPATHLEN];
+	uint64_t start;
+	int round, i, j, fd, r;
+
+	for (round = 0; round < NROUNDS; round++) {
+		start = read_tsc();
+		for (i = 0; i < NFILES; i++) {
+			snprintf(path, sizeof(path), "/stress%d", i);
+			if ((fd = open(path, O_RDWR|O_CREAT|O_TRUNC)) < 0)
+				panic("open %s: %e", path, fd);
+			for (j = 0; j < FBLOCKS; j++) {
+				memset(buf, round * NFILES + i + j, sizeof(buf));
+				if ((r = write(fd, buf, sizeof(buf))) != sizeof(buf))
+					panic("write %s: %e", path, r);
+			}
+			close(fd);
+		}
+		cprintf("round %d: %d files of %d blocks in %llu cycles\n",
+			round, NFILES, FBLOCKS, read_tsc() - start);
+
+		// Check a file, then give the blocks back.
+		if ((fd = open("/stress0", O_RDONLY)) < 0)
+			panic("open /stress0: %e", fd);
+		for (j = 0; j < FBLOCKS; j++) {
+			if ((r = readn(fd, buf, sizeof(buf))) != sizeof(buf))
+				panic("read /stress0: %e", r);
+			if (buf[0] != (char) (round * NFILES + j)
+			    || buf[BLKSIZE - 1] != buf[0])
+				panic("/stress0 block %d is wrong", j);
+		}
+		close(fd);
+		for (i = 0; i < NFILES; i++) {
+			snprintf(path, sizeof(path), "/stress%d", i);
+			if ((fd = open(path, O_RDWR)) < 0)
+				panic("open %s: %e", path, fd);
+			if ((r = ftruncate(fd, 0)) < 0)
+				panic("ftruncate %s: %e", path, r);
+			close(fd);
+		}
+	}
+	cprintf("stressfs ok\n");
+}
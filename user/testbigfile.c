@@ -0,0 +1,90 @@
+// Write a file that reaches past the single indirect block well into
+// the double-indirect one, read it back, then shrink it in stages that
+// free several of the indirect blocks under the double-indirect block.
+// The file is many times the size of the file server's block cache, so
+// this also makes the cache evict.
+
+#include <inc/lib.h>
+
+// Just over 16MB: the direct and single indirect blocks, then four
+// indirect blocks under the double-indirect block.
+#define DIND(i)	(NDIRECT + NINDIRECT + (i) * NINDIRECT)
+#define NBLOCKS	(DIND(3) + 100)
+
+uint32_t buf[BLKSIZE / 4];
+
+static void
+fill(uint32_t bno)
+{
+	int i;
+
+	for (i = 0; i < BLKSIZE / 4; i++)
+		buf[i] = bno * 0x9E3779B1 + i;
+}
+
+static void
+check(int fd, uint32_t nblocks)
+{
+	struct Stat st;
+	uint32_t bno;
+	int r;
+
+	if ((r = fstat(fd, &st)) < 0)
+		panic("fstat: %e", r);
+	if (st.st_size != nblocks * BLKSIZE)
+		panic("size is %d, not %d", st.st_size, nblocks * BLKSIZE);
+	seek(fd, 0);
+	for (bno = 0; bno < nblocks; bno++) {
+		if ((r = readn(fd, buf, BLKSIZE)) != BLKSIZE)
+			panic("read block %d: %e", bno, r);
+		if (buf[0] != bno * 0x9E3779B1
+		    || buf[BLKSIZE / 4 - 1] != bno * 0x9E3779B1 + BLKSIZE / 4 - 1)
+			panic("block %d is wrong", bno);
+	}
+}
+
+void
+umain(int argc, char **argv)
+{
+	uint32_t bno;
+	int fd, r;
+
+	if ((fd = open("/bigfile", O_RDWR|O_CREAT|O_TRUNC)) < 0)
+		panic("open /bigfile: %e", fd);
+	for (bno = 0; bno < NBLOCKS; bno++) {
+		fill(bno);
+		if ((r = write(fd, buf, BLKSIZE)) != BLKSIZE)
+			panic("write block %d: %e", bno, r);
+	}
+	check(fd, NBLOCKS);
+	cprintf("%d blocks through the double-indirect block are good\n", NBLOCKS);
+	sync();		// with debug set, the file server prints its cache counters
+
+	// Into the second indirect block under the double-indirect one,
+	// freeing the last two; into the single indirect block, freeing the
+	// rest and the double-indirect block; then into the direct blocks.
+	if ((r = ftruncate(fd, (DIND(1) + 50) * BLKSIZE)) < 0)
+		panic("ftruncate: %e", r);
+	check(fd, DIND(1) + 50);
+	if ((r = ftruncate(fd, (NDIRECT + 100) * BLKSIZE)) < 0)
+		panic("ftruncate: %e", r);
+	check(fd, NDIRECT + 100);
+	if ((r = ftruncate(fd, 2 * BLKSIZE)) < 0)
+		panic("ftruncate: %e", r);
+	check(fd, 2);
+	close(fd);
+
+	// The freed blocks can be had again.
+	if ((fd = open("/bigfile", O_RDWR|O_TRUNC)) < 0)
+		panic("open /bigfile: %e", fd);
+	for (bno = 0; bno < NBLOCKS; bno++) {
+		fill(bno);
+		if ((r = write(fd, buf, BLKSIZE)) != BLKSIZE)
+			panic("rewrite block %d: %e", bno, r);
+	}
+	check(fd, NBLOCKS);
+	if ((r = ftruncate(fd, 0)) < 0)
+		panic("ftruncate: %e", r);
+	close(fd);
+	cprintf("testbigfile ok\n");
+}
@@ -0,0 +1,56 @@
+// Test the file server channel transport: the same file operations as
+// over IPC, but with every request after open sent on a shared ring.
+
+#include <inc/lib.h>
+
+const char *msg = "This is the NEW message of the day!\n\n";
+
+static char buf[3 * PGSIZE];
+
+void
+umain(int argc, char **argv)
+{
+	int r, f, i;
+	struct Stat st;
+
+	if ((r = fs_channel()) < 0)
+		panic("fs_channel: %e", r);
+	cprintf("fs_channel is good\n");
+
+	if ((f = open("/newmotd", O_RDONLY)) < 0)
+		panic("open /newmotd: %e", f);
+	if ((r = fstat(f, &st)) < 0)
+		panic("fstat: %e", r);
+	if (st.st_size != strlen(msg) || strcmp(st.st_name, "newmotd") != 0)
+		panic("fstat returned %s size %d", st.st_name, st.st_size);
+	memset(buf, 0, sizeof buf);
+	if ((r = readn(f, buf, sizeof buf)) != strlen(msg))
+		panic("read returned %d", r);
+	if (strcmp(buf, msg) != 0)
+		panic("read returned wrong data");
+	close(f);
+	cprintf("channel read is good\n");
+
+	if ((f = open("/chanfile", O_RDWR | O_CREAT | O_TRUNC)) < 0)
+		panic("open /chanfile: %e", f);
+	for (i = 0; i < sizeof buf; i++)
+		buf[i] = i;
+	if ((r = write(f, buf, sizeof buf)) != sizeof buf)
+		panic("write returned %d", r);
+	if ((r = seek(f, 0)) < 0)
+		panic("seek: %e", r);
+	memset(buf, 0, sizeof buf);
+	if ((r = readn(f, buf, sizeof buf)) != sizeof buf)
+		panic("read back returned %d", r);
+	for (i = 0; i < sizeof buf; i++)
+		if (buf[i] != (char) i)
+			panic("read back wrong data at %d", i);
+	if ((r = ftruncate(f, PGSIZE)) < 0)
+		panic("ftruncate: %e", r);
+	if ((r = fstat(f, &st)) < 0 || st.st_size != PGSIZE)
+		panic("fstat after ftruncate: %e size %d", r, st.st_size);
+	close(f);
+	if ((r = sync()) < 0)
+		panic("sync: %e", r);
+	cprintf("channel write is good\n");
+}
@@ -0,0 +1,62 @@
+// Test coroutines: yielding, sleeping and waking, and running more of
+// them, one after another, than exist at once.
+
+#include <inc/lib.h>
+
+#define NROUNDS		4
+#define NYIELDS		50
+
+struct CoroQueue gate;
+int nstarted, nfinished;
+int trace[NCORO * NYIELDS];
+int ntrace;
+
+static void
+yielder(void *arg)
+{
+	int i, id = (int) arg;
+	char buf[2 * PGSIZE];	// use most of the stack
+
+	memset(buf, id, sizeof(buf));
+	nstarted++;
+	coro_sleep(&gate);
+	for (i = 0; i < NYIELDS; i++) {
+		trace[ntrace++] = id;
+		coro_yield();
+	}
+	for (i = 0; i < sizeof(buf); i++)
+		if (buf[i] != (char) id)
+			panic("coroutine %d: stack smashed at %d", id, i);
+	nfinished++;
+}
+
+void
+umain(int argc, char **argv)
+{
+	int i, round, r;
+
+	for (round = 0; round < NROUNDS; round++) {
+		nstarted = nfinished = ntrace = 0;
+		for (i = 0; i < NCORO; i++)
+			if ((r = coro_create(yielder, (void *) i)) < 0)
+				panic("coro_create: %e", r);
+		if ((r = coro_create(yielder, (void *) i)) != -E_NO_MEM)
+			panic("coro_create beyond NCORO: %e", r);
+
+		// Everyone runs up to the gate and sleeps there.
+		coro_run();
+		if (nstarted != NCORO || nfinished != 0)
+			panic("%d started, %d finished before the gate opened",
+			      nstarted, nfinished);
+
+		// Round robin once the gate opens.
+		coro_wakeup(&gate);
+		coro_run();
+		if (nfinished != NCORO)
+			panic("%d coroutines finished", nfinished);
+		for (i = 0; i < ntrace; i++)
+			if (trace[i] != i % NCORO)
+				panic("trace[%d] = %d, not round robin", i, trace[i]);
+	}
+	cprintf("testcoro ok\n");
+}
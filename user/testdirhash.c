@@ -0,0 +1,47 @@
+// Fill a directory with many files, then open each of them and some
+// names that are not there, timing both, to exercise the directory
+// name index.
+
+#include <inc/lib.h>
+#include <inc/x86.h>
+
+#define NFILES	1000
+
+void
+umain(int argc, char **argv)
+{
+	char path[MAXPATHLEN];
+	struct Stat st;
+	uint64_t start;
+	int i, fd;
+
+	start = read_tsc();
+	for (i = 0; i < NFILES; i++) {
+		snprintf(path, sizeof(path), "/dirhash%d", i);
+		if ((fd = open(path, O_RDWR|O_CREAT)) < 0)
+			panic("create %s: %e", path, fd);
+		close(fd);
+	}
+	cprintf("created %d files in %llu cycles\n", NFILES, read_tsc() - start);
+
+	start = read_tsc();
+	for (i = NFILES - 1; i >= 0; i--) {
+		snprintf(path, sizeof(path), "/dirhash%d", i);
+		if ((fd = open(path, O_RDONLY)) < 0)
+			panic("open %s: %e", path, fd);
+		if (fstat(fd, &st) < 0 || strcmp(st.st_name, path + 1) != 0)
+			panic("open %s found %s", path, st.st_name);
+		close(fd);
+	}
+	for (i = 0; i < NFILES; i++) {
+		snprintf(path, sizeof(path), "/dirhash%d.no", i);
+		if ((fd = open(path, O_RDONLY)) != -E_NOT_FOUND)
+			panic("open %s: %e", path, fd);
+	}
+	cprintf("looked up %d names twice in %llu cycles\n", NFILES, read_tsc() - start);
+
+	// The files are all there still, and no new ones.
+	if ((fd = open("/dirhash0", O_RDWR|O_CREAT|O_EXCL)) != -E_FILE_EXISTS)
+		panic("exclusive create of /dirhash0: %e", fd);
+	cprintf("testdirhash ok\n");
+}
@@ -0,0 +1,49 @@
+// Check that FPU/SSE registers survive context switches: several
+// environments keep values in FPU and SSE registers across sys_yield
+// and check that nobody else's values show up.
+
+#include <inc/lib.h>
+
+#define NKIDS	4
+#define NROUNDS	200
+
+static void
+check(int id)
+{
+	double x;
+	uint32_t in[4], out[4];
+	int i;
+
+	for (i = 0; i < 4; i++)
+		in[i] = id * 0x01010101 + i;
+	x = id;
+	asm volatile("movups %0, %%xmm0" : : "m" (in));
+	for (i = 0; i < NROUNDS; i++) {
+		// Keep x on the x87 stack across the yield.
+		asm volatile("fldl %0" : : "m" (x));
+		sys_yield();
+		asm volatile("fld1; faddp; fstpl %0" : "=m" (x));
+		asm volatile("movups %%xmm0, %0" : "=m" (out));
+		if (memcmp(in, out, sizeof(in)) != 0)
+			panic("env %d: xmm0 is %08x, not %08x", id, out[0], in[0]);
+	}
+	if (x != id + NROUNDS)
+		panic("env %d: x87 result %d, not %d", id, (int) x, id + NROUNDS);
+}
+
+void
+umain(int argc, char **argv)
+{
+	envid_t kids[NKIDS];
+	int i;
+
+	for (i = 0; i < NKIDS; i++)
+		if ((kids[i] = fork()) == 0) {
+			check(i + 1);
+			return;
+		}
+	check(0);
+	for (i = 0; i < NKIDS; i++)
+		wait(kids[i]);
+	cprintf("testfpu ok\n");
+}
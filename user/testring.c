@@ -0,0 +1,104 @@
+// Test the submission/completion ring: system calls queued on it are
+// carried out when we enter the kernel, and, while we are blocked, by
+// an idle CPU.
+
+#include <inc/lib.h>
+
+#define RING	((struct Ring *) 0xD0000000)
+#define PAGES	((char *) 0xD0400000)
+#define NPAGES	300
+
+static int ncomplete;
+
+// Collect completions, checking each succeeded.
+static void
+reap_all(void)
+{
+	struct RingCqe cqe;
+
+	while (ring_reap(RING, &cqe)) {
+		if (cqe.cqe_res < 0)
+			panic("call %d failed: %e", cqe.cqe_tag, cqe.cqe_res);
+		ncomplete++;
+	}
+}
+
+static void
+submit(uint32_t tag, uint32_t op, uint32_t a1, uint32_t a2, uint32_t a3)
+{
+	int r;
+
+	while ((r = ring_submit(RING, tag, op, a1, a2, a3, 0, 0)) == -E_NO_MEM)
+		reap_all();
+	if (r < 0)
+		panic("ring_submit: %e", r);
+}
+
+// Queue a notification to our parent, then go away; once nothing is
+// runnable, an idle CPU carries it out for the blocked parent.
+static void
+notifier(void *arg)
+{
+	submit(NPAGES, SYS_notify, thisenv->env_parent_id, NOTIFY_CHAN, 0);
+}
+
+void
+umain(int argc, char **argv)
+{
+	struct RingCqe cqe;
+	envid_t tid;
+	int i, r;
+
+	if ((r = ring_setup(RING)) < 0)
+		panic("ring_setup: %e", r);
+
+	// Many more calls than the ring holds.
+	for (i = 0; i < NPAGES; i++)
+		submit(i, SYS_page_alloc, 0, (uint32_t) (PAGES + i * PGSIZE),
+		       PTE_P|PTE_U|PTE_W);
+	while (ncomplete < NPAGES) {
+		sys_ring_enter();
+		reap_all();
+	}
+	for (i = 0; i < NPAGES; i++)
+		PAGES[i * PGSIZE] = i;
+
+	for (i = 0; i < NPAGES; i++)
+		submit(i, SYS_page_unmap, 0, (uint32_t) (PAGES + i * PGSIZE), 0);
+	while (ncomplete < 2 * NPAGES) {
+		sys_ring_enter();
+		reap_all();
+	}
+	for (i = 0; i < NPAGES; i++)
+		if (uvpt[PGNUM(PAGES + i * PGSIZE)] & PTE_P)
+			panic("page %d still mapped", i);
+
+	// Bad calls fail without harm.
+	submit(0, SYS_env_destroy, 0, 0, 0);
+	sys_ring_enter();
+	if (!ring_reap(RING, &cqe) || cqe.cqe_res != -E_INVAL)
+		panic("ring carried out sys_env_destroy");
+	cprintf("testring: %d calls completed\n", ncomplete);
+
+	// The ring survives a fork: it is not made copy-on-write, so we
+	// go on submitting to the page the kernel drains.
+	if ((tid = fork()) < 0)
+		panic("fork: %e", tid);
+	if (tid == 0)
+		exit();
+	wait(tid);
+	submit(0, SYS_page_alloc, 0, (uint32_t) PAGES, PTE_P|PTE_U|PTE_W);
+	sys_ring_enter();
+	if (!ring_reap(RING, &cqe) || cqe.cqe_res != 0
+	    || !(uvpt[PGNUM(PAGES)] & PTE_P))
+		panic("ring lost after fork");
+
+	if ((tid = thread_create(notifier, NULL)) < 0)
+		panic("thread_create: %e", tid);
+	while (!(sys_wait_notify(NOTIFY_CHAN | NOTIFY_RING) & NOTIFY_CHAN))
+		/* the thread's submission has not been carried out */;
+	thread_join(tid);
+	if (!ring_reap(RING, &cqe) || cqe.cqe_tag != NPAGES || cqe.cqe_res != 0)
+		panic("idle CPU did not complete the notification");
+	cprintf("testring ok\n");
+}
@@ -0,0 +1,82 @@
+// Test sfork threads, mutexes and condition variables.
+
+#include <inc/lib.h>
+
+#define NWORKERS	4
+#define NITER		2000
+#define NITEMS		100
+
+struct Mutex lock = MUTEX_INITIALIZER;
+struct Cond nonempty = COND_INITIALIZER;
+struct Cond nonfull = COND_INITIALIZER;
+volatile uint32_t counter;
+
+// One-slot buffer between producer and consumer.
+volatile int slot, full;
+volatile int consumed_sum;
+
+static void
+worker(void *arg)
+{
+	int i;
+	uint32_t c;
+
+	for (i = 0; i < NITER; i++) {
+		mutex_lock(&lock);
+		c = counter;
+		if (i % 100 == 0)
+			sys_yield();	// invite a race if the lock is broken
+		counter = c + 1;
+		mutex_unlock(&lock);
+	}
+}
+
+static void
+consumer(void *arg)
+{
+	int i, sum = 0;
+
+	for (i = 0; i < NITEMS; i++) {
+		mutex_lock(&lock);
+		while (!full)
+			cond_wait(&nonempty, &lock);
+		sum += slot;
+		full = 0;
+		cond_signal(&nonfull);
+		mutex_unlock(&lock);
+	}
+	consumed_sum = sum;
+}
+
+void
+umain(int argc, char **argv)
+{
+	envid_t tids[NWORKERS], ctid;
+	int i, r;
+
+	for (i = 0; i < NWORKERS; i++)
+		if ((tids[i] = thread_create(worker, 0)) < 0)
+			panic("thread_create: %e", tids[i]);
+	for (i = 0; i < NWORKERS; i++)
+		if ((r = thread_join(tids[i])) < 0)
+			panic("thread_join: %e", r);
+	if (counter != NWORKERS * NITER)
+		panic("counter is %d, not %d", counter, NWORKERS * NITER);
+	cprintf("mutex ok\n");
+
+	if ((ctid = thread_create(consumer, 0)) < 0)
+		panic("thread_create: %e", ctid);
+	for (i = 1; i <= NITEMS; i++) {
+		mutex_lock(&lock);
+		while (full)
+			cond_wait(&nonfull, &lock);
+		slot = i;
+		full = 1;
+		cond_signal(&nonempty);
+		mutex_unlock(&lock);
+	}
+	thread_join(ctid);
+	if (consumed_sum != NITEMS * (NITEMS + 1) / 2)
+		panic("consumed %d, not %d", consumed_sum, NITEMS * (NITEMS + 1) / 2);
+	cprintf("cond ok\n");
+}